@@ -2,6 +2,7 @@
 #include <ranges>
 #include <sstream>
 #include "lox/callable.hpp"
+#include "lox/compilation_unit.hpp"
 #include "lox/object.hpp"
 #include "lox/builtins/clock.hpp"
 #include "lox/builtins/dir.hpp"
@@ -11,7 +12,7 @@
 
 namespace lox
 {
-	object callable::operator()(interpreter& inter, std::vector<object> const& arguments) const
+	object callable::operator()(interpreter& inter, std::span<const object> arguments) const
 	{ return impl_->call(inter, arguments); }
 
 	std::vector<callable> callable::builtins()
@@ -24,7 +25,7 @@ namespace lox
 
 	namespace builtin
 	{
-		object clock::call(interpreter& inter, std::vector<object> const& args) const
+		object clock::call(interpreter& inter, std::span<const object> args) const
 		{
 			ignore_unused(inter, args);
 
@@ -35,7 +36,7 @@ namespace lox
 			return object{std::chrono::duration_cast<seconds>(tp).count()};
 		}
 
-		object dir::call(interpreter& inter, std::vector<object> const& args) const
+		object dir::call(interpreter& inter, std::span<const object> args) const
 		{
 			ignore_unused(args);
 
@@ -87,13 +88,15 @@ namespace lox
 	{
 	public:
 		explicit lox_function_impl(func_stmt const& declaration, environment_ptr&& closure)
-		: declaration_{declaration}
-		, closure_{closure}
+		: unit_{declaration.unit().shared_from_this()}
+		, declaration_{&declaration}
+		, closure_{std::move(closure)}
 		{
 			assert(closure_);
+			track();
 		}
 
-		func_stmt const& declaration() const { return declaration_; }
+		func_stmt const& declaration() const { return *declaration_; }
 		environment_ptr const& closure() const { return closure_; }
 
 		size_t arity() const override
@@ -101,48 +104,21 @@ namespace lox
 			return declaration().parameters().size();
 		}
 
-		object call(interpreter& inter, std::vector<object> const& arguments) const override
+		object call(interpreter& inter, std::span<const object> arguments) const override
 		{
 			// Should have already been validated, but sanity check
 			assert(arguments.size() == arity());
 
-			// push new environment
-			// NOTE: this causes a cyclic reference & a memory leak.
-			// TODO: fix the leak
-			scope s{&inter.stack(), closure()};
-			(void)s;
+			interpreter::call_frame frame{inter, declaration().frame_size()};
 
-#ifdef __cpp_lib_ranges_zip
-			std::ranges::for_each(
-				std::views::zip(declaration().parameters(), arguments),
-				[&env=inter.current_env()](auto&& t)
-				{
-					auto name = std::get<0>(t).lexeme();
-					auto const& value{std::get<1>(t)};
-					env.define(name, value);
-				}
-			);
-#else
-			auto& env = inter.current_env();
-			auto const& params = declaration().parameters();
-			for (size_t i = 0; i < arity(); ++i)
-			{
-				auto name{std::string{params[i].lexeme()}};
-				auto value{arguments[i]};
-				env.define(name, std::move(value));
-			}
-#endif
-
-			try
-			{
-				inter.execute_block(declaration().body());
-			}
-			catch(interpreter::return_value const& rv)
+			if (declaration().has_scope())
 			{
-				return rv.value_;
+				scope s{&inter.stack(), closure()};
+				return run(inter, arguments);
 			}
 
-			return {};
+			scope s{&inter.stack(), closure(), reenter};
+			return run(inter, arguments);
 		}
 
 		std::string name() const override
@@ -153,15 +129,36 @@ namespace lox
 		std::string str() const override
 		{ return fmt::format("<fn {}>", name()); }
 
+		void trace(tracer& t) const override
+		{ t(closure_.get()); }
+
+	protected:
+		void clear_references() override
+		{ closure_.reset(); }
+
 	private:
-		func_stmt declaration_;
+		std::shared_ptr<compilation_unit const> unit_;
+		func_stmt const* declaration_;
 		environment_ptr closure_;
+
+		object run(interpreter& inter, std::span<const object> arguments) const
+		{
+			auto const& params{declaration().parameters()};
+			for (std::size_t i = 0; i < params.size(); ++i)
+				inter.define(declaration().parameter(i), params[i].symbol(), arguments[i]);
+
+			if (inter.execute_block(declaration().body()) == interpreter::completion::returning)
+				return inter.take_return_value();
+
+			return {};
+		}
 	};
 
 
 	callable callable::make_lox_function(func_stmt const& declaration, environment_ptr closure)
 	{
-		return callable{std::make_shared<lox_function_impl>(declaration, std::move(closure))};
+		heap::get().maybe_collect();
+		return callable{make_ref<lox_function_impl>(declaration, std::move(closure))};
 	}
 
 }
@@ -1,6 +1,9 @@
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <string_view>
+#include <vector>
 #include <sysexits.h>
 
 #include "lox/lox.hpp"
@@ -8,44 +11,123 @@
 
 using namespace lox;
 
-void run_prompt(Lox& lox)
+struct options
 {
-	std::cout << "lox REPL. Enter EOF to stop." << std::endl;
+	bool streamed = false;
+	bool cache_beside = false;         // <script>c next to the script
+	std::filesystem::path cache_dir;   // <content hash>.loxc in a directory
+};
 
-	for (std::string line; std::cout << "> " << std::flush, std::getline(std::cin, line); )
+void run_file(Lox& lox, std::string_view path, options const& opts)
+{
+	auto run = [&](source const& input)
+	{
+		if (!opts.cache_dir.empty())
+		{
+			auto key{flat::cache_key::of(input)};
+			lox.run_cached(input, opts.cache_dir / fmt::format("{:016x}.loxc", key.content_hash), key);
+		}
+		else if (opts.cache_beside && path != "-")
+			lox.run_cached(input, std::filesystem::path{std::string{path} + "c"});
+		else if (opts.streamed)
+			lox.run_streamed(input);
+		else
+			lox.run(input);
+	};
+
+	if (path == "-")
+	{
+		stream_source input{"<stdin>", std::cin};
+		run(input);
+	}
+	else if (std::filesystem::exists(path) && !std::filesystem::is_regular_file(path))
+	{
+		// pipes and devices can't be mapped
+		std::ifstream stream{std::string{path}, std::ios::binary};
+		stream_source input{path, stream};
+		run(input);
+	}
+	else
 	{
-		string_source ss{"<stdin>", line};
-		lox.run(ss);
+		file_source file{path};
+		run(file);
 	}
-	std::cout << "stopped." << std::endl;
 }
 
-void run_file(Lox& lox, std::string_view path)
+
+void usage(const char* program)
 {
-	file_source file{path};
-	lox.run(file);
+	std::cerr << "Usage: " << program << " [--engine=tree|flat|vm] [--stream | --cache | --cache-dir=DIR] [script | -]" << std::endl;
 }
 
-
 int main(int argc, const char** argv)
 {
 	Lox lox;
-	switch(argc)
+	options opts;
+
+	std::vector<std::string_view> args{argv + 1, argv + argc};
+	while (!args.empty() && args.front().starts_with("--"))
 	{
-		case 1:
-			run_prompt(lox);
+		auto option{args.front()};
+		if (option.starts_with("--engine="))
+		{
+			auto name{option.substr(std::string_view{"--engine="}.size())};
+			if (name == "vm")
+				lox.engine(engine::vm);
+			else if (name == "tree")
+				lox.engine(engine::tree_walker);
+			else if (name == "flat")
+				lox.engine(engine::flat);
+			else
+			{
+				usage(argv[0]);
+				return EX_USAGE;
+			}
+		}
+		else if (option == "--stream")
+			opts.streamed = true;
+		else if (option == "--cache")
+			opts.cache_beside = true;
+		else if (option.starts_with("--cache-dir="))
+			opts.cache_dir = option.substr(std::string_view{"--cache-dir="}.size());
+		else
+		{
+			usage(argv[0]);
+			return EX_USAGE;
+		}
+		args.erase(args.begin());
+	}
+
+	// a cached program runs whole, on the flat evaluator
+	if (opts.streamed && (opts.cache_beside || !opts.cache_dir.empty()))
+	{
+		usage(argv[0]);
+		return EX_USAGE;
+	}
+
+	if (!opts.cache_dir.empty())
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(opts.cache_dir, ec);
+		if (ec)
+			std::cerr << "cannot create cache directory " << opts.cache_dir << ": " << ec.message() << std::endl;
+	}
+
+	switch(args.size())
+	{
+		case 0:
+			lox.run_prompt();
 			break;
 
-		case 2:
-			run_file(lox, argv[1]);
+		case 1:
+			run_file(lox, args.front(), opts);
 			break;
 
 		default:
-			std::cerr << "Usage: " << argv[0] << " [script]" << std::endl;
+			usage(argv[0]);
 			return EX_USAGE;
 	}
 
 
 	return 0;
 }
-
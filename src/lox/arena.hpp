@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace lox
+{
+	// Bump allocator for objects that all die together. Objects are placed
+	// back to back in large blocks and destroyed, in reverse order of
+	// creation, when the arena is.
+	class arena
+	{
+		static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+		// destructor thunk for an object that isn't trivially destructible
+		struct cleanup
+		{
+			void (*destroy)(void*);
+			void* object;
+			cleanup* next;
+		};
+
+	public:
+		arena() = default;
+
+		arena(arena const&) = delete;
+		arena(arena&&) = delete;
+
+		arena& operator=(arena const&) = delete;
+		arena& operator=(arena&&) = delete;
+
+		~arena()
+		{
+			for (auto c = cleanups_; c != nullptr; c = c->next)
+				c->destroy(c->object);
+		}
+
+		void* allocate(std::size_t size, std::size_t align)
+		{
+			auto space{static_cast<std::size_t>(end_ - next_)};
+			void* ptr{next_};
+			if (std::align(align, size, ptr, space) == nullptr)
+			{
+				new_block(size + align);
+				ptr = next_;
+				space = static_cast<std::size_t>(end_ - next_);
+				[[maybe_unused]] auto aligned{std::align(align, size, ptr, space)};
+				assert(aligned);
+			}
+
+			next_ = static_cast<std::byte*>(ptr) + size;
+			used_ += size;
+			return ptr;
+		}
+
+		template<class T, class... Args>
+		T* make(Args&&... args)
+		{
+			cleanup* c{nullptr};
+			if constexpr (!std::is_trivially_destructible_v<T>)
+				c = static_cast<cleanup*>(allocate(sizeof(cleanup), alignof(cleanup)));
+
+			auto obj{new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...)};
+
+			if constexpr (!std::is_trivially_destructible_v<T>)
+			{
+				*c = cleanup{[](void* p) { static_cast<T*>(p)->~T(); }, obj, cleanups_};
+				cleanups_ = c;
+			}
+
+			return obj;
+		}
+
+		// bytes handed out, not counting block slack
+		std::size_t used() const { return used_; }
+
+	private:
+		std::vector<std::unique_ptr<std::byte[]>> blocks_;
+		std::byte* next_ = nullptr;
+		std::byte* end_ = nullptr;
+		std::size_t used_ = 0;
+		cleanup* cleanups_ = nullptr;
+
+		void new_block(std::size_t min_size)
+		{
+			auto size{std::max(BLOCK_SIZE, min_size)};
+			blocks_.push_back(std::make_unique_for_overwrite<std::byte[]>(size));
+			next_ = blocks_.back().get();
+			end_ = next_ + size;
+		}
+	};
+
+	// Handles to arena objects move like unique_ptr but never delete; the
+	// arena frees everything at once.
+	struct arena_owned
+	{
+		void operator()(void const*) const noexcept { }
+	};
+
+	template<class T>
+	using arena_ptr = std::unique_ptr<T, arena_owned>;
+
+} // namespace lox
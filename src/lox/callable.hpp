@@ -2,26 +2,32 @@
 
 #include <cassert>
 #include <memory>
+#include <span>
 #include <vector>
 #include <fmt/format.h>
 
+#include "heap.hpp"
+
 namespace lox
 {
 	class interpreter;
 	class object;
 	class func_stmt;
 	class environment;
-	using environment_ptr = std::shared_ptr<environment>;
+	using environment_ptr = ref_ptr<environment>;
 
 	class callable
 	{
 	public:
 
-		struct impl
+		struct impl : heap_object
 		{
-			virtual ~impl() = default;
+			impl()
+			: heap_object{kind::CALLABLE}
+			{ }
+
 			virtual size_t arity() const = 0;
-			virtual object call(interpreter& inter, std::vector<object> const& arguments) const = 0;
+			virtual object call(interpreter& inter, std::span<const object> arguments) const = 0;
 			virtual std::string name() const = 0;
 			virtual std::string str() const = 0;
 		};
@@ -31,7 +37,7 @@ namespace lox
 			std::string str() const override final { return fmt::format("<builtin fn {} at {}>", name(), reinterpret_cast<const void*>(this)); }
 		};
 
-		explicit callable(std::shared_ptr<const impl>&& cimpl)
+		explicit callable(ref_ptr<const impl> cimpl)
 		: impl_{std::move(cimpl)}
 		{
 			assert(impl_);
@@ -39,35 +45,26 @@ namespace lox
 
 		callable() = default;
 		callable(callable const&) = default;
-		callable(callable&& other)
-		: impl_{other.impl_}
-		{ }
+		callable(callable&&) = default;
 
 		callable& operator=(callable const&) = default;
-		callable& operator=(callable&& other)
-		{
-			// we don't really move, just share the impl.
-			if (this != &other)
-			{
-				impl_ = other.impl_;
-			}
-			return *this;
-		}
+		callable& operator=(callable&&) = default;
 
 		bool valid() const { return static_cast<bool>(impl_); }
 
 		std::string name() const { return impl_->name(); }
 		size_t arity() const { return impl_->arity(); }
-		object operator()(interpreter& inter, std::vector<object> const& arguments) const;
+		object operator()(interpreter& inter, std::span<const object> arguments) const;
 		std::string str() const { return impl_->str(); }
 
 		impl const& cimpl() const { return *impl_; }
+		ref_ptr<const impl> const& ptr() const { return impl_; }
 
 
 		template<class Impl>
 		static callable make()
 		{
-			return callable{std::make_shared<Impl>()};
+			return callable{make_ref<Impl>()};
 		}
 
 		static callable make_lox_function(func_stmt const& declaration, environment_ptr closure);
@@ -75,7 +72,7 @@ namespace lox
 		static std::vector<callable> builtins();
 
 	private:
-		std::shared_ptr<const impl> impl_;
+		ref_ptr<const impl> impl_;
 	};
 
 } // namespace lox
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace lox {
+
+	// Bounded single-producer/single-consumer queue. Closing it from either
+	// side wakes the other: the consumer drains what is left, the producer
+	// learns its pushes are no longer wanted.
+	template<class T>
+	class channel
+	{
+	public:
+		explicit channel(std::size_t capacity)
+		: capacity_{capacity}
+		{ }
+
+		channel(channel const&) = delete;
+		channel& operator=(channel const&) = delete;
+
+		// Blocks while the channel is full. Returns false once it is closed.
+		bool push(T value)
+		{
+			std::unique_lock lock{mutex_};
+			not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+			if (closed_)
+				return false;
+
+			items_.push_back(std::move(value));
+			not_empty_.notify_one();
+			return true;
+		}
+
+		// Blocks until an item arrives. Empty once the channel is closed and
+		// drained.
+		std::optional<T> pop()
+		{
+			std::unique_lock lock{mutex_};
+			not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+			if (items_.empty())
+				return std::nullopt;
+
+			std::optional<T> value{std::move(items_.front())};
+			items_.pop_front();
+			not_full_.notify_one();
+			return value;
+		}
+
+		void close()
+		{
+			std::lock_guard lock{mutex_};
+			closed_ = true;
+			not_full_.notify_all();
+			not_empty_.notify_all();
+		}
+
+	private:
+		std::mutex mutex_;
+		std::condition_variable not_full_;
+		std::condition_variable not_empty_;
+		std::deque<T> items_;
+		std::size_t capacity_;
+		bool closed_ = false;
+	};
+
+} // namespace lox
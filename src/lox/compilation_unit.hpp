@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "arena.hpp"
+#include "statement.hpp"
+
+namespace lox {
+
+	class compilation_unit;
+	using compilation_unit_ptr = std::shared_ptr<compilation_unit>;
+
+	// The syntax tree of one parsed input. Every node lives in the unit's
+	// arena and is freed with it; functions defined by the unit keep it
+	// alive for as long as they can be called.
+	class compilation_unit : public std::enable_shared_from_this<compilation_unit>
+	{
+	public:
+		using statement_vec = std::vector<statement_ptr>;
+
+		compilation_unit() = default;
+
+		compilation_unit(compilation_unit const&) = delete;
+		compilation_unit(compilation_unit&&) = delete;
+
+		compilation_unit& operator=(compilation_unit const&) = delete;
+		compilation_unit& operator=(compilation_unit&&) = delete;
+
+		arena& memory() { return arena_; }
+		arena const& memory() const { return arena_; }
+
+		statement_vec& statements() { return statements_; }
+		statement_vec const& statements() const { return statements_; }
+
+		// The input the unit's tokens refer to, when nothing else keeps it
+		// alive, such as a REPL line. Null otherwise.
+		std::shared_ptr<source const> const& owned_source() const { return owned_source_; }
+		void owned_source(std::shared_ptr<source const> input) { owned_source_ = std::move(input); }
+
+	private:
+		arena arena_;
+		statement_vec statements_;
+		std::shared_ptr<source const> owned_source_;
+	};
+
+} // namespace lox
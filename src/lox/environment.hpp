@@ -4,160 +4,189 @@
 #include <iostream>
 #include <memory>
 #include <ranges>
-#include <unordered_map>
+#include <vector>
 #include <fmt/format.h>
 
 #include "object.hpp"
+#include "symbol.hpp"
 
 namespace lox {
 
 	class environment;
-	using environment_ptr = std::shared_ptr<environment>;
+	using environment_ptr = ref_ptr<environment>;
 
-	class environment : public std::enable_shared_from_this<environment>
+	// Environments form cycles with the functions that close over them, so
+	// they are tracked by the collector (see heap.hpp).
+	class environment final : public gc_object
 	{
-		using value_map = std::unordered_map<std::string, object>;
+		struct global
+		{
+			object value;
+			bool defined = false;
+		};
 
 		[[noreturn]]
-		static void undefined(std::string const& name)
+		static void undefined(symbol_id name)
 		{
-			throw runtime_error{fmt::format("Undefined variable '{}'.", name)};
+			throw runtime_error{fmt::format("Undefined variable '{}'.", symbol_name(name))};
 		}
 
 	public:
 		explicit environment(environment_ptr enclosing = environment_ptr{})
-		: enclosing_{enclosing}
-		{ }
+		: enclosing_{std::move(enclosing)}
+		{
+			track();
+		}
 
 		environment(environment const&) = delete;
-		environment(environment&&) = default;
+		environment(environment&&) = delete;
 
 		environment& operator=(environment const&) = delete;
-		environment& operator=(environment&&) = default;
+		environment& operator=(environment&&) = delete;
 
 		environment_ptr const& enclosing() const { return enclosing_; }
 
-		environment_ptr ancestor(std::size_t distance)
+		environment& ancestor(std::size_t distance)
 		{
-			environment_ptr env{shared_from_this()};
+			environment* env{this};
 
 			for (std::size_t i{0}; i < distance; ++i)
 			{
 				assert(env->enclosing());
-				env = env->enclosing();
+				env = env->enclosing_.get();
 			}
 
-			return env;
+			return *env;
 		}
 
-		object get_at(std::size_t distance, std::string const& name)
-		{
-			auto env{ancestor(distance)};
-			auto i{env->values_.find(name)};
-			if (i == env->values_.end())
-				return {};
-			return i->second;
-		}
-		
-		template<typename Token, typename T>
-		void assign_at(std::size_t distance, Token const& name, T&& value)
+		object const& get_at(std::size_t distance, std::size_t slot)
 		{
-			assign_at(distance, std::string{name.lexeme()}, std::forward<T>(value));
+			auto& env{ancestor(distance)};
+			assert(slot < env.slots_.size());
+			return env.slots_[slot];
 		}
 
 		template<typename T>
-		void assign_at(std::size_t distance, std::string const& name, T&& value)
+		void assign_at(std::size_t distance, std::size_t slot, T&& value)
 		{
-			ancestor(distance)->values_.insert_or_assign(name, std::forward<T>(value));
+			auto& env{ancestor(distance)};
+			assert(slot < env.slots_.size());
+			env.slots_[slot] = std::forward<T>(value);
 		}
 
-		template<typename T, typename U>
-		void define(T&& name, U&& value)
+		// Globals live in a table indexed by symbol; every other environment
+		// stores its variables in slots, in the order the resolver numbered
+		// them.
+		template<typename U>
+		void define(symbol_id name, U&& value)
 		{
 #ifdef LOX_ENV_TRACE
-			std::cerr << "env[" << this << "]::define(name: '" << name << "', value: [" << value.str() << "])" << std::endl;
+			std::cerr << "env[" << this << "]::define(name: '" << symbol_name(name) << "', value: [" << value.str() << "])" << std::endl;
 #endif
-			values_.insert_or_assign(
-				std::forward<T>(name),
-				std::forward<U>(value)
-			);
+			if (enclosing_)
+			{
+				slots_.emplace_back(std::forward<U>(value));
+				slot_names_.push_back(name);
+			}
+			else
+			{
+				if (name >= globals_.size())
+					globals_.resize(name + 1);
+				globals_[name] = global{std::forward<U>(value), true};
+			}
 		}
 
 		template<typename U>
-		void assign(std::string const& name, U&& value)
+		void assign(symbol_id name, U&& value)
 		{
-			auto env{this};
-			while (env != nullptr)
-			{
 #ifdef LOX_ENV_TRACE
-				std::cerr << "env[" << env << "]::assign(name: '" << name << "', value: [" << value.str() << "])" << std::endl;
+			std::cerr << "env[" << this << "]::assign(name: '" << symbol_name(name) << "', value: [" << value.str() << "])" << std::endl;
 #endif
-				auto i = env->values_.find(name);
-				if (i == end(env->values_))
-				{
-					env = env->enclosing_.get();
-				}
-				else
-				{
-					i->second = std::forward<U>(value);
-					return;
-				}
-			}
-
-			undefined(name);
+			check_defined(name);
+			globals_[name].value = std::forward<U>(value);
 		}
 
-		object get(std::string const& name) const
+		object const& get(symbol_id name) const
 		{
-			auto env{this};
-
-			while (env != nullptr)
-			{
-#ifdef LOX_ENV_TRACE
-				std::cerr << "env[" << env << ", enclosing: " << env->enclosing_.get() << "]::get(name: '" << name << "') ..." << std::endl;
-#endif
-				auto i = env->values_.find(name);
-				if (i == env->values_.end())
-				{
-					env = env->enclosing_.get();
-				}
-				else
-				{
-#ifdef LOX_ENV_TRACE
-					std::cerr << "env[" << env << ", enclosing: " << env->enclosing_.get() << "]::get(name: '" << name << "') ret = " << i->second.str() << std::endl;
-#endif
-
-					return i->second;
-				}
-			}
-			
 #ifdef LOX_ENV_TRACE
-			std::cerr << "env[" << this << "]::get(name: '" << name << "') *undefined*" << std::endl;
+			std::cerr << "env[" << this << "]::get(name: '" << symbol_name(name) << "')" << std::endl;
 #endif
-			undefined(name);
+			check_defined(name);
+			return globals_[name].value;
 		}
 
 		std::vector<std::string> names() const
 		{
 			std::vector<std::string> names;
+			for (symbol_id id{0}; id < globals_.size(); ++id)
+			{
+				if (globals_[id].defined)
+					names.emplace_back(symbol_name(id));
+			}
 			std::ranges::copy(
-				std::views::transform(values_, [](auto&& p) { return p.first; }),
+				std::views::transform(slot_names_, [](auto id) { return std::string{symbol_name(id)}; }),
 				std::back_inserter(names)
 			);
 			return names;
 		}
 
+		// Empties an environment that nothing else refers to so it can be
+		// reused as a fresh scope; the slot storage keeps its capacity.
+		void reset(environment_ptr enclosing = {})
+		{
+			assert(use_count() == 1);
+			clear_references();
+			enclosing_ = std::move(enclosing);
+		}
+
+		void trace(tracer& t) const override
+		{
+			t(enclosing_.get());
+			for (auto&& g : globals_)
+				g.value.trace(t);
+			for (auto&& value : slots_)
+				value.trace(t);
+		}
+
+	protected:
+		void clear_references() override
+		{
+			enclosing_.reset();
+			globals_.clear();
+			slots_.clear();
+			slot_names_.clear();
+		}
+
 	private:
 		environment_ptr enclosing_;
-		value_map values_;
+		std::vector<global> globals_;
+		std::vector<object> slots_;
+		std::vector<symbol_id> slot_names_;
+
+		// only the global environment is searched by name
+		void check_defined(symbol_id name) const
+		{
+			assert(!enclosing_);
+			if (name >= globals_.size() || !globals_[name].defined)
+				undefined(name);
+		}
 	};
 
 	class scope_stack;
 
+	// Selects the scope constructor that enters an existing environment
+	// instead of a new one enclosed by it.
+	struct reenter_t { explicit reenter_t() = default; };
+	inline constexpr reenter_t reenter{};
+
 	class scope
 	{
 	public:
 		explicit scope(scope_stack* scope, environment_ptr closure = {});
+
+		// For a call whose locals all live in its frame: runs it in the
+		// environment it closed over.
+		scope(scope_stack* scope, environment_ptr env, reenter_t);
 		~scope();
 
 		scope(scope const&) = delete;
@@ -198,24 +227,64 @@ namespace lox {
 		scope_stack& operator=(scope_stack const&) = delete;
 		scope_stack& operator=(scope_stack&&) = default;
 
+		// Drops every scope, including the globals.
+		void clear()
+		{
+			stack_.clear();
+			pool_.clear();
+		}
+
 		[[nodiscard]] environment& current() { assert(!stack_.empty()); return *stack_.back(); }
 		[[nodiscard]] environment& global() { assert(!stack_.empty()); return *stack_.front(); }
 
 	private:
+		static constexpr std::size_t POOL_MAX = 64;
+
 		std::vector<environment_ptr> stack_;
 
+		// Scopes that didn't escape (nothing captured them) are kept here
+		// and reused, so calls and blocks don't allocate once warmed up.
+		std::vector<environment_ptr> pool_;
+
 		[[nodiscard]] environment_ptr push(environment_ptr closure = {})
 		{
 			if (stack_.empty())
-				stack_.emplace_back(std::make_shared<environment>());
+			{
+				stack_.emplace_back(make_ref<environment>());
+				return stack_.back();
+			}
+
+			auto enclosing{closure ? std::move(closure) : stack_.back()};
+			if (pool_.empty())
+			{
+				heap::get().maybe_collect();
+				stack_.emplace_back(make_ref<environment>(std::move(enclosing)));
+			}
 			else
-				stack_.emplace_back(std::make_shared<environment>(closure ? closure : stack_.back()));
+			{
+				pool_.back()->reset(std::move(enclosing));
+				stack_.emplace_back(std::move(pool_.back()));
+				pool_.pop_back();
+			}
+			return stack_.back();
+		}
+
+		[[nodiscard]] environment_ptr enter(environment_ptr env)
+		{
+			assert(env);
+			stack_.emplace_back(std::move(env));
 			return stack_.back();
 		}
 
 		void pop()
 		{
 			assert(stack_.size() > 1); // don't want to pop the global env
+			auto& env{stack_.back()};
+			if (env->use_count() == 1 && pool_.size() < POOL_MAX)
+			{
+				env->reset();
+				pool_.push_back(std::move(env));
+			}
 			stack_.pop_back();
 		}
 	};
@@ -226,18 +295,25 @@ namespace lox {
 	{
 		assert(stack_ != nullptr);
 		env_ = stack_->push(closure);
-		assert(env_ != nullptr);
+		assert(env_);
+	}
+
+	inline scope::scope(scope_stack* stack, environment_ptr env, reenter_t)
+	: stack_{stack}
+	{
+		assert(stack_ != nullptr);
+		env_ = stack_->enter(std::move(env));
 	}
 
 	inline scope::~scope()
 	{
 		assert(stack_ != nullptr);
-		assert(env_ != nullptr);
+		assert(env_);
 		assert(&stack_->current() == env_.get());
 
+		env_.reset();
 		stack_->pop();
 		stack_ = nullptr;
-		env_.reset();
 	}
 
 
@@ -1,9 +1,15 @@
 #pragma once
 #include <cassert>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <typeinfo>
 
+#include "arena.hpp"
+#include "exceptions.hpp"
+#include "object.hpp"
 #include "token.hpp"
 #include "utility.hpp"
 
@@ -19,8 +25,25 @@ namespace lox {
 	class logical;
 	class unary;
 	class variable;
+
+	// rewrites nodes' children in place after resolution
+	class optimizer;
 	
-	using expression_ptr = std::unique_ptr<expression>;
+	using expression_ptr = arena_ptr<expression>;
+
+	// Resolved location of a local variable: how many environments to walk
+	// up from the current one, and the slot within that environment. A
+	// local no function captures has depth `frame` instead, and `slot` is
+	// its place in the running call's frame.
+	struct local_slot
+	{
+		static constexpr std::uint32_t frame = std::numeric_limits<std::uint32_t>::max();
+
+		std::uint32_t depth;
+		std::uint32_t slot;
+
+		bool in_frame() const { return depth == frame; }
+	};
 
 	enum class expression_type
 	{
@@ -34,29 +57,96 @@ namespace lox {
 		ASSIGN
 	};
 
+	// What a unary, binary or logical node computes. It's taken from the
+	// operator token when the parser builds the node, so evaluation can
+	// switch on it without going back to the token, which is kept for
+	// diagnostics.
+	enum class unary_op : std::uint8_t
+	{
+		NEGATE,
+		NOT
+	};
+
+	enum class binary_op : std::uint8_t
+	{
+		ADD,
+		SUBTRACT,
+		MULTIPLY,
+		DIVIDE,
+		EQUAL,
+		NOT_EQUAL,
+		GREATER,
+		GREATER_EQUAL,
+		LESS,
+		LESS_EQUAL
+	};
+
+	enum class logical_op : std::uint8_t
+	{
+		AND,
+		OR
+	};
+
+	// The operands a binary node has seen, so the interpreter can take a
+	// path specialized to them behind a cheap guard. A node starts unseen,
+	// is specialized by its first evaluation, and goes generic for good the
+	// first time its guard fails. The PROVEN profiles are set by the
+	// resolver when inference shows the operands can be nothing else, and
+	// need no guard.
+	enum class operand_profile : std::uint8_t
+	{
+		UNSEEN,
+		NUMBERS,
+		STRINGS,
+		GENERIC,
+		PROVEN_NUMBERS,
+		PROVEN_STRINGS
+	};
+
+	// What the resolver's type inference proved an expression evaluates
+	// to whenever it doesn't raise; UNKNOWN where it couldn't tell.
+	enum class inferred_type : std::uint8_t
+	{
+		UNKNOWN,
+		NUMBER,
+		BOOL,
+		STRING
+	};
+
 	class expression
 	{
 	public:
 
 		using enum expression_type;
 
-		class visitor
+		// Each visit returns R: `visitor` is for passes that keep their own
+		// state, `value_visitor` for evaluation, so values are returned up
+		// the tree rather than left in a member.
+		template<class R>
+		class basic_visitor
 		{
 		public:
-			virtual ~visitor() {}
-
-			virtual void visit(assign const& expr) = 0;
-			virtual void visit(binary const& expr) = 0;
-			virtual void visit(call const& expr) = 0;
-			virtual void visit(grouping const& expr) = 0;
-			virtual void visit(literal const& expr) = 0;
-			virtual void visit(logical const& expr) = 0;
-			virtual void visit(unary const& expr) = 0;
-			virtual void visit(variable const& expr) = 0;
+			virtual ~basic_visitor() {}
+
+			virtual R visit(assign const& expr) = 0;
+			virtual R visit(binary const& expr) = 0;
+			virtual R visit(call const& expr) = 0;
+			virtual R visit(grouping const& expr) = 0;
+			virtual R visit(literal const& expr) = 0;
+			virtual R visit(logical const& expr) = 0;
+			virtual R visit(unary const& expr) = 0;
+			virtual R visit(variable const& expr) = 0;
 		};
 
+		using visitor = basic_visitor<void>;
+		using value_visitor = basic_visitor<object>;
+
+	protected:
+		explicit expression(expression_type type)
+		: type_{type}
+		{ }
+
 	public:
-		expression() = default;
 		expression(expression const&) = default;
 		expression(expression&&) = default;
 
@@ -66,11 +156,22 @@ namespace lox {
 		virtual ~expression() { }
 
 		virtual void accept(visitor& v) const = 0;
-		virtual expression_type type() const = 0;
+		virtual object accept(value_visitor& v) const = 0;
+
+		// kept in the node, so dispatching on it costs no virtual call
+		expression_type type() const { return type_; }
+
+		// set by the resolver; literals know theirs from the start
+		inferred_type inferred() const { return inferred_; }
+		void infer(inferred_type type) const { inferred_ = type; }
 
 		template<class ExprType, class... Args>
-		static expression_ptr make(Args&&... args)
-		{ return std::make_unique<ExprType>(std::forward<Args>(args)...); }
+		static expression_ptr make(arena& memory, Args&&... args)
+		{ return expression_ptr{memory.make<ExprType>(std::forward<Args>(args)...)}; }
+
+	private:
+		expression_type type_;
+		mutable inferred_type inferred_ = inferred_type::UNKNOWN;
 	};
 
 	class unary : public expression
@@ -78,8 +179,10 @@ namespace lox {
 	public:
 
 		unary(token&& op_token, expression_ptr&& right)
-		: op_token_{std::move(op_token)}
+		: expression{expression_type::UNARY}
+		, op_token_{std::move(op_token)}
 		, right_{std::move(right)}
+		, op_{op_of(op_token_)}
 		{
 			assert(right_.get());
 		}
@@ -90,16 +193,31 @@ namespace lox {
 		unary& operator=(unary const&) = delete;
 		unary& operator=(unary&& other) = default;
 
-		expression_type type() const override { return UNARY; }
 
-		token op_token() const { return op_token_; }
+		unary_op op() const { return op_; }
+		token const& op_token() const { return op_token_; }
 		expression const& right() const { return *right_; }
 
 		void accept(visitor& v) const override { v.visit(*this); }
+		object accept(value_visitor& v) const override { return v.visit(*this); }
+
+		friend class optimizer;
 
 	private:
 		token op_token_;
 		expression_ptr right_;
+		unary_op op_;
+
+		static unary_op op_of(token const& op_token)
+		{
+			switch (op_token.type())
+			{
+				case token_type::BANG: return unary_op::NOT;
+				case token_type::MINUS: return unary_op::NEGATE;
+				default:
+					LOX_THROW(programming_error, fmt::format("unsupported unary operator: '{}'", op_token.lexeme()));
+			}
+		}
 	};
 
 	class binary : public expression
@@ -107,9 +225,11 @@ namespace lox {
 	public:
 
 		binary(expression_ptr&& left, token&& op_token, expression_ptr&& right)
-		: left_{std::move(left)}
+		: expression{expression_type::BINARY}
+		, left_{std::move(left)}
 		, op_token_{std::move(op_token)}
 		, right_{std::move(right)}
+		, op_{op_of(op_token_)}
 		{
 			assert(left_.get());
 			assert(right_.get());
@@ -121,18 +241,46 @@ namespace lox {
 		binary& operator=(binary const&) = delete;
 		binary& operator=(binary&&) = default;
 
-		expression_type type() const override { return BINARY; }
 
 		expression const& left() const { return *left_; }
-		token op_token() const { return op_token_; }
+		binary_op op() const { return op_; }
+		token const& op_token() const { return op_token_; }
 		expression const& right() const { return *right_; }
 
+		// updated by the interpreter as the node runs
+		operand_profile profile() const { return profile_; }
+		void specialize(operand_profile profile) const { profile_ = profile; }
+
 		void accept(visitor& v) const override { v.visit(*this); }
+		object accept(value_visitor& v) const override { return v.visit(*this); }
+
+		friend class optimizer;
 
 	private:
 		expression_ptr left_;
 		token op_token_;
 		expression_ptr right_;
+		binary_op op_;
+		mutable operand_profile profile_ = operand_profile::UNSEEN;
+
+		static binary_op op_of(token const& op_token)
+		{
+			switch (op_token.type())
+			{
+				case token_type::BANG_EQUAL: return binary_op::NOT_EQUAL;
+				case token_type::EQUAL_EQUAL: return binary_op::EQUAL;
+				case token_type::GREATER: return binary_op::GREATER;
+				case token_type::GREATER_EQUAL: return binary_op::GREATER_EQUAL;
+				case token_type::LESS: return binary_op::LESS;
+				case token_type::LESS_EQUAL: return binary_op::LESS_EQUAL;
+				case token_type::MINUS: return binary_op::SUBTRACT;
+				case token_type::PLUS: return binary_op::ADD;
+				case token_type::SLASH: return binary_op::DIVIDE;
+				case token_type::STAR: return binary_op::MULTIPLY;
+				default:
+					LOX_THROW(programming_error, fmt::format("unhandled binary operator: '{}'", op_token.lexeme()));
+			}
+		}
 	};
 
 	class call : public expression
@@ -141,20 +289,23 @@ namespace lox {
 		using argument_vec = std::vector<expression_ptr>;
 		
 		call(expression_ptr&& callee, token&& paren, argument_vec&& arguments)
-		: callee_{std::move(callee)}
+		: expression{expression_type::CALL}
+		, callee_{std::move(callee)}
 		, paren_{std::move(paren)}
 		, arguments_{std::move(arguments)}
 		{
 			assert(callee_);
 		}
 
-		expression_type type() const override { return CALL; }
 
 		expression const& callee() const { return *callee_; };
 		token const& paren() const { return paren_; }
 		argument_vec const& arguments() const { return arguments_; }
 
 		void accept(visitor& v) const override { v.visit(*this); }
+		object accept(value_visitor& v) const override { return v.visit(*this); }
+
+		friend class optimizer;
 
 	private:
 		expression_ptr callee_;
@@ -167,7 +318,8 @@ namespace lox {
 	public:
 
 		explicit grouping(expression_ptr&& expr)
-		: expr_{std::move(expr)}
+		: expression{expression_type::GROUPING}
+		, expr_{std::move(expr)}
 		{
 			assert(expr_.get());
 		}
@@ -178,11 +330,13 @@ namespace lox {
 		grouping& operator=(grouping const&) = delete;
 		grouping& operator=(grouping&&) = default;
 
-		expression_type type() const override { return GROUPING; }
 
 		expression const& expr() const { return *expr_; }
 
 		void accept(visitor& v) const override { v.visit(*this); }
+		object accept(value_visitor& v) const override { return v.visit(*this); }
+
+		friend class optimizer;
 
 	private:
 		expression_ptr expr_;
@@ -193,28 +347,34 @@ namespace lox {
 	public:
 
 		explicit literal(object&& value)
-		: value_{std::move(value)}
-		{ }
+		: expression{expression_type::LITERAL}
+		, value_{std::move(value)}
+		{ infer(inferred_of(value_)); }
 
 		explicit literal(object const& value)
-		: value_{value}
-		{ }
+		: expression{expression_type::LITERAL}
+		, value_{value}
+		{ infer(inferred_of(value_)); }
 
 		explicit literal(double value)
-		: value_{value}
-		{ }
+		: expression{expression_type::LITERAL}
+		, value_{value}
+		{ infer(inferred_of(value_)); }
 
 		explicit literal(const char* value)
-		: value_{std::string{value}}
-		{ }
+		: expression{expression_type::LITERAL}
+		, value_{std::string{value}}
+		{ infer(inferred_type::STRING); }
 
 		explicit literal(bool value)
-		: value_{value}
-		{ }
+		: expression{expression_type::LITERAL}
+		, value_{value}
+		{ infer(inferred_of(value_)); }
 
 		explicit literal(nullptr_t value)
-		: value_{value}
-		{ }
+		: expression{expression_type::LITERAL}
+		, value_{value}
+		{ infer(inferred_of(value_)); }
 
 
 		literal(literal const&) = delete;
@@ -223,30 +383,44 @@ namespace lox {
 		literal& operator=(literal const&) = delete;
 		literal& operator=(literal&&) = default;
 
-		expression_type type() const override { return LITERAL; }
 
 		template<typename T>
 		explicit operator T() const
-		{ return std::get<T>(value_); }
+		{ return value_.get<T>(); }
 
 		object const& value() const { return value_; }
 
 		void accept(visitor& v) const override { v.visit(*this); }
+		object accept(value_visitor& v) const override { return v.visit(*this); }
 
 	private:
 		object value_;
+
+		static inferred_type inferred_of(object const& value)
+		{
+			if (value.is_double())
+				return inferred_type::NUMBER;
+			if (value.is_bool())
+				return inferred_type::BOOL;
+			if (value.as_string())
+				return inferred_type::STRING;
+			return inferred_type::UNKNOWN;
+		}
 	};
 
 	class logical : public expression
 	{
 	public:
 		explicit logical(expression_ptr&& left, token&& op_token, expression_ptr&& right)
-		: left_{std::move(left)}
+		: expression{expression_type::LOGICAL}
+		, left_{std::move(left)}
 		, right_{std::move(right)}
 		, op_token_{std::move(op_token)}
+		, op_{op_token_.type() == token_type::OR ? logical_op::OR : logical_op::AND}
 		{
 			assert(left_);
 			assert(right_);
+			assert(op_token_.type() == token_type::OR || op_token_.type() == token_type::AND);
 		}
 
 		logical(logical const&) = delete;
@@ -255,17 +429,21 @@ namespace lox {
 		logical& operator=(logical const&) = delete;
 		logical& operator=(logical&&) = default;
 
-		expression_type type() const override { return LOGICAL; }
 		void accept(visitor& v) const override { v.visit(*this); }
+		object accept(value_visitor& v) const override { return v.visit(*this); }
 
 		expression const& left() const { return *left_; }
+		logical_op op() const { return op_; }
 		token const& op_token() const { return op_token_; }
 		expression const& right() const { return *right_; }
 
+		friend class optimizer;
+
 	private:
 		expression_ptr left_;
 		expression_ptr right_;
 		token op_token_;
+		logical_op op_;
 	};
 
 	
@@ -274,7 +452,8 @@ namespace lox {
 	public:
 		template<typename T>
 		explicit variable(T&& name_token)
-		: name_token_{std::forward<T>(name_token)}
+		: expression{expression_type::VARIABLE}
+		, name_token_{std::forward<T>(name_token)}
 		{ }
 
 		variable(variable const&) = delete;
@@ -283,15 +462,21 @@ namespace lox {
 		variable& operator=(variable const&) = delete;
 		variable& operator=(variable&&) = default;
 
-		expression_type type() const override { return VARIABLE; }
 
 		token const& name_token() const { return name_token_; }
+		symbol_id symbol() const { return name_token_.symbol(); }
 		std::string name() const { return std::string{name_token_.lexeme()}; }
 
+		// set by the resolver; empty for globals.
+		std::optional<local_slot> const& local() const { return local_; }
+		void resolve(local_slot slot) const { local_ = slot; }
+
 		void accept(visitor& v) const override { v.visit(*this); }
+		object accept(value_visitor& v) const override { return v.visit(*this); }
 
 	private:
 		token name_token_;
+		mutable std::optional<local_slot> local_;
 	};
 
 	class assign : public expression
@@ -299,7 +484,8 @@ namespace lox {
 	public:
 		template<typename T>
 		explicit assign(T&& name_token, expression_ptr&& value)
-		: name_token_{std::forward<T>(name_token)}
+		: expression{expression_type::ASSIGN}
+		, name_token_{std::forward<T>(name_token)}
 		, value_{std::move(value)}
 		{
 			assert(value_);
@@ -311,17 +497,25 @@ namespace lox {
 		assign& operator=(assign const&) = delete;
 		assign& operator=(assign&&) = default;
 
-		expression_type type() const override { return ASSIGN; }
 
 		token const& name_token() const { return name_token_; }
+		symbol_id symbol() const { return name_token_.symbol(); }
 		std::string name() const { return std::string{name_token_.lexeme()}; }
 		expression const& value() const{ return *value_; }
 
+		// set by the resolver; empty for globals.
+		std::optional<local_slot> const& local() const { return local_; }
+		void resolve(local_slot slot) const { local_ = slot; }
+
 		void accept(visitor& v) const override { v.visit(*this); }
+		object accept(value_visitor& v) const override { return v.visit(*this); }
+
+		friend class optimizer;
 
 	private:
 		token name_token_;
 		expression_ptr value_;
+		mutable std::optional<local_slot> local_;
 	};
 
 } // namespace lox
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "../compilation_unit.hpp"
+#include "../expr.hpp"
+#include "../object.hpp"
+#include "../statement.hpp"
+#include "../symbol.hpp"
+
+// A flattened copy of a compilation unit's syntax tree. Nodes are numbered
+// and stored column-wise: one array per field, indexed by node. Children,
+// symbols and constants are referenced by 32-bit index, so walking the
+// tree touches a few dense arrays instead of chasing pointers between
+// polymorphic nodes, and nothing in it refers to memory outside it.
+namespace lox::flat
+{
+	using node_id = std::uint32_t;
+
+	inline constexpr node_id no_node = std::numeric_limits<node_id>::max();
+	inline constexpr std::uint32_t global_slot = std::numeric_limits<std::uint32_t>::max();
+
+	// Operands by kind. Lists are offsets into the list pool and each
+	// begins with its length; a local is an index into the resolved slots.
+	enum class node_kind : std::uint8_t
+	{
+		// expressions
+		ASSIGN,     // a: value, b: symbol, c: local
+		BINARY,     // op, a: left, b: right
+		CALL,       // a: callee, b: argument list
+		GROUPING,   // a: expression
+		LITERAL,    // a: constant
+		LOGICAL,    // op, a: left, b: right
+		UNARY,      // op, a: operand
+		VARIABLE,   // b: symbol, c: local
+
+		// statements
+		BLOCK,      // a: 1 if it declares anything and so opens a scope, b: statement list
+		EXPRESSION, // a: expression
+		FOR,        // a: initializer or no_node, b: condition, c: list of body and increment, if any
+		FUNCTION,   // a: name symbol, b: parameter symbol list, c: body statement list
+		IF,         // a: condition, b: then, c: else or no_node
+		PRINT,      // a: expression
+		RETURN,     // a: value or no_node
+		VAR,        // a: initializer or no_node, b: symbol
+		WHILE       // a: condition, b: body
+	};
+
+	class ast;
+	using ast_ptr = std::shared_ptr<ast>;
+
+	class ast : public std::enable_shared_from_this<ast>
+	{
+	public:
+		ast() = default;
+
+		ast(ast const&) = delete;
+		ast& operator=(ast const&) = delete;
+
+		std::size_t size() const { return kinds_.size(); }
+
+		node_kind kind(node_id n) const { assert(n < size()); return kinds_[n]; }
+		token_type op(node_id n) const { assert(n < size()); return ops_[n]; }
+		std::uint32_t a(node_id n) const { assert(n < size()); return a_[n]; }
+		std::uint32_t b(node_id n) const { assert(n < size()); return b_[n]; }
+		std::uint32_t c(node_id n) const { assert(n < size()); return c_[n]; }
+
+		// source offset of the node's token, for diagnostics
+		std::uint32_t where(node_id n) const { assert(n < size()); return where_[n]; }
+		source::id_type source_id() const { return source_id_; }
+		std::shared_ptr<source const> const& owned_source() const { return owned_source_; }
+
+		std::span<const std::uint32_t> list(std::uint32_t offset) const
+		{
+			assert(offset < lists_.size());
+			return {lists_.data() + offset + 1, lists_[offset]};
+		}
+
+		object const& constant(std::uint32_t index) const { assert(index < constants_.size()); return constants_[index]; }
+
+		// local slot of a resolved VARIABLE or ASSIGN; nullptr for globals
+		local_slot const* local(node_id n) const
+		{
+			auto index{c(n)};
+			return index == global_slot ? nullptr : &locals_[index];
+		}
+
+		void resolve(node_id n, local_slot slot)
+		{
+			assert(kind(n) == node_kind::VARIABLE || kind(n) == node_kind::ASSIGN);
+			c_[n] = static_cast<std::uint32_t>(locals_.size());
+			locals_.push_back(slot);
+		}
+
+		// top-level statements
+		std::span<const node_id> roots() const { return list(roots_); }
+
+		// bytes held by the node arrays and pools
+		std::size_t footprint() const
+		{
+			return size() * (sizeof(node_kind) + sizeof(token_type) + 4 * sizeof(std::uint32_t))
+				+ lists_.size() * sizeof(std::uint32_t)
+				+ constants_.size() * sizeof(object)
+				+ locals_.size() * sizeof(local_slot);
+		}
+
+		static ast_ptr flatten(compilation_unit const& unit);
+
+	private:
+		friend class builder;
+		friend class ast_file;
+
+		std::vector<node_kind> kinds_;
+		std::vector<token_type> ops_;
+		std::vector<std::uint32_t> a_;
+		std::vector<std::uint32_t> b_;
+		std::vector<std::uint32_t> c_;
+		std::vector<std::uint32_t> where_;
+		std::vector<std::uint32_t> lists_;
+		std::vector<object> constants_;
+		std::vector<local_slot> locals_;
+		std::uint32_t roots_ = 0;
+		source::id_type source_id_ = 0;
+		std::shared_ptr<source const> owned_source_; // see compilation_unit::owned_source
+	};
+
+	// Copies a pointer tree into an ast, children before their parents.
+	class builder
+		: expression::visitor
+		, statement::visitor
+	{
+	public:
+		explicit builder(ast& out)
+		: out_{&out}
+		{ }
+
+		void build(compilation_unit const& unit)
+		{
+			std::vector<std::uint32_t> roots;
+			for (auto&& stmt : unit.statements())
+				roots.push_back(add(*stmt));
+			out_->roots_ = add_list(roots);
+		}
+
+	private:
+		ast* out_;
+		node_id last_ = no_node;
+
+		node_id add(expression const& expr) { expr.accept(*this); return last_; }
+		node_id add(statement const& stmt) { stmt.accept(*this); return last_; }
+
+		node_id add_optional(expression_ptr const& expr) { return expr ? add(*expr) : no_node; }
+
+		template<class Node>
+		node_id add_optional(std::optional<std::reference_wrapper<const Node>> const& node)
+		{ return node ? add(node->get()) : no_node; }
+
+		// offset of a token that locates a node
+		std::uint32_t at(token const& tok)
+		{
+			out_->source_id_ = tok.source_id();
+			return tok.offset();
+		}
+
+		// a node without a token of its own is located at a child
+		std::uint32_t at(node_id child) const
+		{
+			return child == no_node ? 0 : out_->where_[child];
+		}
+
+		void emit(node_kind kind, std::uint32_t where, std::uint32_t a = 0, std::uint32_t b = 0, std::uint32_t c = 0, token_type op = token_type::END_OF_FILE)
+		{
+			last_ = static_cast<node_id>(out_->kinds_.size());
+			out_->kinds_.push_back(kind);
+			out_->ops_.push_back(op);
+			out_->a_.push_back(a);
+			out_->b_.push_back(b);
+			out_->c_.push_back(c);
+			out_->where_.push_back(where);
+		}
+
+		std::uint32_t add_list(std::vector<std::uint32_t> const& items)
+		{
+			auto offset{static_cast<std::uint32_t>(out_->lists_.size())};
+			out_->lists_.push_back(static_cast<std::uint32_t>(items.size()));
+			out_->lists_.insert(out_->lists_.end(), items.begin(), items.end());
+			return offset;
+		}
+
+		template<class Statements>
+		std::uint32_t add_statements(Statements const& statements)
+		{
+			std::vector<std::uint32_t> ids;
+			for (auto&& stmt : statements)
+				ids.push_back(add(*stmt));
+			return add_list(ids);
+		}
+
+		//
+		// expressions
+		//
+		void visit(assign const& expr) override
+		{
+			auto value{add(expr.value())};
+			emit(node_kind::ASSIGN, at(expr.name_token()), value, expr.symbol(), global_slot);
+		}
+
+		void visit(binary const& expr) override
+		{
+			auto left{add(expr.left())};
+			auto right{add(expr.right())};
+			auto const& op{expr.op_token()};
+			emit(node_kind::BINARY, at(op), left, right, 0, op.type());
+		}
+
+		void visit(call const& expr) override
+		{
+			auto callee{add(expr.callee())};
+			std::vector<std::uint32_t> args;
+			for (auto&& arg : expr.arguments())
+				args.push_back(add(*arg));
+			emit(node_kind::CALL, at(expr.paren()), callee, add_list(args));
+		}
+
+		void visit(grouping const& expr) override
+		{
+			auto inner{add(expr.expr())};
+			emit(node_kind::GROUPING, at(inner), inner);
+		}
+
+		void visit(literal const& expr) override
+		{
+			auto index{static_cast<std::uint32_t>(out_->constants_.size())};
+			out_->constants_.push_back(expr.value());
+			emit(node_kind::LITERAL, 0, index);
+		}
+
+		void visit(logical const& expr) override
+		{
+			auto left{add(expr.left())};
+			auto right{add(expr.right())};
+			auto const& op{expr.op_token()};
+			emit(node_kind::LOGICAL, at(op), left, right, 0, op.type());
+		}
+
+		void visit(unary const& expr) override
+		{
+			auto right{add(expr.right())};
+			auto const& op{expr.op_token()};
+			emit(node_kind::UNARY, at(op), right, 0, 0, op.type());
+		}
+
+		void visit(variable const& expr) override
+		{
+			emit(node_kind::VARIABLE, at(expr.name_token()), 0, expr.symbol(), global_slot);
+		}
+
+		//
+		// statements
+		//
+		void visit(block_stmt const& stmt) override
+		{
+			std::vector<std::uint32_t> ids;
+			bool declares{false};
+			for (auto&& s : stmt.statements())
+			{
+				ids.push_back(add(*s));
+				declares |= out_->kinds_[last_] == node_kind::VAR || out_->kinds_[last_] == node_kind::FUNCTION;
+			}
+			emit(node_kind::BLOCK, 0, declares ? 1 : 0, add_list(ids));
+		}
+
+		void visit(expression_stmt const& stmt) override
+		{
+			auto expr{add(stmt.expr())};
+			emit(node_kind::EXPRESSION, at(expr), expr);
+		}
+
+		void visit(for_stmt const& stmt) override
+		{
+			auto initializer{add_optional(stmt.initializer())};
+			auto condition{add(stmt.condition())};
+			std::vector<std::uint32_t> rest{add(stmt.body())};
+			if (auto&& increment = stmt.increment())
+				rest.push_back(add(increment->get()));
+			emit(node_kind::FOR, at(condition), initializer, condition, add_list(rest));
+		}
+
+		void visit(func_stmt const& stmt) override
+		{
+			std::vector<std::uint32_t> params;
+			for (auto&& param : stmt.parameters())
+				params.push_back(param.symbol());
+			auto param_list{add_list(params)};
+			auto body{add_statements(stmt.body())};
+			emit(node_kind::FUNCTION, at(stmt.name()), stmt.name().symbol(), param_list, body);
+		}
+
+		void visit(if_stmt const& stmt) override
+		{
+			auto condition{add(stmt.condition())};
+			auto then_branch{add(stmt.then_branch())};
+			auto else_branch{add_optional(stmt.else_branch())};
+			emit(node_kind::IF, at(condition), condition, then_branch, else_branch);
+		}
+
+		void visit(print_stmt const& stmt) override
+		{
+			auto expr{add(stmt.expr())};
+			emit(node_kind::PRINT, at(expr), expr);
+		}
+
+		void visit(return_stmt const& stmt) override
+		{
+			auto value{add_optional(stmt.value())};
+			emit(node_kind::RETURN, at(stmt.keyword()), value);
+		}
+
+		void visit(var_stmt const& stmt) override
+		{
+			auto initializer{add_optional(stmt.initializer())};
+			emit(node_kind::VAR, at(stmt.name()), initializer, stmt.name().symbol());
+		}
+
+		void visit(while_stmt const& stmt) override
+		{
+			auto condition{add(stmt.condition())};
+			auto body{add(stmt.body())};
+			emit(node_kind::WHILE, at(condition), condition, body);
+		}
+	};
+
+	inline ast_ptr ast::flatten(compilation_unit const& unit)
+	{
+		auto out{std::make_shared<ast>()};
+		builder{*out}.build(unit);
+		out->owned_source_ = unit.owned_source();
+		return out;
+	}
+
+} // namespace lox::flat
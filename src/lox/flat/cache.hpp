@@ -0,0 +1,508 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "../source_file.hpp"
+#include "../version.hpp"
+#include "ast.hpp"
+
+// On-disk copy of a resolved flat::ast, so a script that hasn't changed
+// can be run without scanning, parsing or resolving it again.
+//
+// The file is a fixed header followed by the ast's columns and pools,
+// each padded to 8 bytes so they sit aligned in the mapping. Symbols are
+// process-local, so the file carries the names it uses and symbol
+// operands are stored as indexes into that list. Numbers are stored in
+// native byte order; the header records it.
+namespace lox::flat
+{
+	inline constexpr std::uint64_t fnv1a(std::string_view bytes, std::uint64_t hash = 0xcbf29ce484222325ull)
+	{
+		for (auto c : bytes)
+		{
+			hash ^= static_cast<unsigned char>(c);
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	// What a cache file must have been built from to be used.
+	struct cache_key
+	{
+		std::uint64_t content_hash;
+		std::uint64_t content_size;
+
+		static cache_key of(source const& input)
+		{
+			return cache_key{fnv1a(input.view()), input.size()};
+		}
+
+		bool operator==(cache_key const&) const = default;
+	};
+
+	class ast_file
+	{
+		static constexpr char MAGIC[4] = {'L', 'O', 'X', 'C'};
+		static constexpr std::uint32_t ORDER_MARK = 0x01020304;
+		static constexpr std::size_t ALIGN = 8;
+
+		struct header
+		{
+			char magic[4];
+			std::uint32_t byte_order;
+			std::uint32_t format;
+			std::uint32_t padding;
+			std::uint64_t version;
+			std::uint64_t content_hash;
+			std::uint64_t content_size;
+			std::uint32_t nodes;
+			std::uint32_t lists;
+			std::uint32_t locals;
+			std::uint32_t symbols;
+			std::uint32_t constants;
+			std::uint32_t roots;
+		};
+
+		static_assert(std::is_trivially_copyable_v<header>);
+		static_assert(std::is_trivially_copyable_v<local_slot>);
+
+	public:
+		// Writes to a temporary and renames it into place, so a reader never
+		// sees half a file. Returns false if it couldn't be written.
+		static bool save(ast const& tree, cache_key key, std::filesystem::path const& path)
+		{
+			auto columns{symbols_to_file(tree)};
+
+			auto temp{path};
+			temp += fmt::format(".{}.tmp", ::getpid());
+			{
+				std::ofstream out{temp, std::ios::binary | std::ios::trunc};
+				if (!out)
+					return false;
+
+				writer w{out};
+				w.put(header{
+					{MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3]},
+					ORDER_MARK,
+					ast_format_version,
+					0,
+					fnv1a(version),
+					key.content_hash,
+					key.content_size,
+					static_cast<std::uint32_t>(tree.size()),
+					static_cast<std::uint32_t>(tree.lists_.size()),
+					static_cast<std::uint32_t>(tree.locals_.size()),
+					static_cast<std::uint32_t>(columns.names.size()),
+					static_cast<std::uint32_t>(tree.constants_.size()),
+					tree.roots_
+				});
+
+				w.put(tree.kinds_);
+				w.put(tree.ops_);
+				w.put(columns.a);
+				w.put(columns.b);
+				w.put(tree.c_);
+				w.put(tree.where_);
+				w.put(columns.lists);
+				w.put(tree.locals_);
+
+				for (auto name : columns.names)
+					w.put_string(name);
+				w.align();
+
+				for (auto&& value : tree.constants_)
+					w.put_constant(value);
+				w.align();
+
+				if (!out.flush())
+				{
+					std::error_code ec;
+					std::filesystem::remove(temp, ec);
+					return false;
+				}
+			}
+
+			std::error_code ec;
+			std::filesystem::rename(temp, path, ec);
+			if (ec)
+				std::filesystem::remove(temp, ec);
+			return !ec;
+		}
+
+		// Null unless the file exists, is intact, and was written for this
+		// key by this version of the interpreter. Diagnostics from the
+		// loaded tree refer to `input`.
+		static ast_ptr load(std::filesystem::path const& path, cache_key key, source const& input)
+		{
+			std::error_code ec;
+			if (!std::filesystem::is_regular_file(path, ec) || std::filesystem::file_size(path, ec) < sizeof(header))
+				return nullptr;
+
+			try
+			{
+				boost::interprocess::file_mapping file{path.c_str(), boost::interprocess::read_only};
+				boost::interprocess::mapped_region region{file, boost::interprocess::read_only};
+
+				reader r{static_cast<char const*>(region.get_address()), region.get_size()};
+				return read(r, key, input);
+			}
+			catch (boost::interprocess::interprocess_exception const&)
+			{
+				return nullptr;
+			}
+		}
+
+	private:
+		struct file_columns
+		{
+			std::vector<std::uint32_t> a;
+			std::vector<std::uint32_t> b;
+			std::vector<std::uint32_t> lists;
+			std::vector<std::string_view> names;
+		};
+
+		class writer
+		{
+		public:
+			explicit writer(std::ofstream& out)
+			: out_{&out}
+			{ }
+
+			template<class T>
+			void put(T const& value)
+			{
+				static_assert(std::is_trivially_copyable_v<T>);
+				write(&value, sizeof(T));
+			}
+
+			template<class T>
+			void put(std::vector<T> const& values)
+			{
+				static_assert(std::is_trivially_copyable_v<T>);
+				write(values.data(), values.size() * sizeof(T));
+				align();
+			}
+
+			void put_string(std::string_view s)
+			{
+				put(static_cast<std::uint32_t>(s.size()));
+				write(s.data(), s.size());
+			}
+
+			void put_constant(object const& value)
+			{
+				auto type{value.get_type()};
+				put(static_cast<std::uint8_t>(type));
+				switch (type)
+				{
+					case object::type::NIL: break;
+					case object::type::BOOL: put(static_cast<std::uint8_t>(static_cast<bool>(value))); break;
+					case object::type::DOUBLE: put(static_cast<double>(value)); break;
+					case object::type::STRING: put_string(value.as_string()->value()); break;
+					default:
+						LOX_THROW(programming_error, "only literals can be cached");
+				}
+			}
+
+			void align()
+			{
+				static constexpr char zeros[ALIGN] = {};
+				if (auto extra = written_ % ALIGN)
+					write(zeros, ALIGN - extra);
+			}
+
+		private:
+			std::ofstream* out_;
+			std::size_t written_ = 0;
+
+			void write(void const* data, std::size_t size)
+			{
+				out_->write(static_cast<char const*>(data), static_cast<std::streamsize>(size));
+				written_ += size;
+			}
+		};
+
+		// Reads from the mapping; every take fails rather than read past it.
+		class reader
+		{
+		public:
+			reader(char const* data, std::size_t size)
+			: begin_{data}
+			, p_{data}
+			, end_{data + size}
+			{ }
+
+			template<class T>
+			bool take(T& value)
+			{
+				static_assert(std::is_trivially_copyable_v<T>);
+				if (static_cast<std::size_t>(end_ - p_) < sizeof(T))
+					return false;
+				std::memcpy(&value, p_, sizeof(T));
+				p_ += sizeof(T);
+				return true;
+			}
+
+			template<class T>
+			bool take(std::vector<T>& values, std::size_t count)
+			{
+				static_assert(std::is_trivially_copyable_v<T>);
+				if (static_cast<std::size_t>(end_ - p_) / sizeof(T) < count)
+					return false;
+				values.resize(count);
+				if (count == 0)
+					return align(); // data() may be null, which memcpy doesn't allow
+				std::memcpy(values.data(), p_, count * sizeof(T));
+				p_ += count * sizeof(T);
+				return align();
+			}
+
+			bool take_string(std::string_view& s)
+			{
+				std::uint32_t size;
+				if (!take(size) || static_cast<std::size_t>(end_ - p_) < size)
+					return false;
+				s = std::string_view{p_, size};
+				p_ += size;
+				return true;
+			}
+
+			bool take_constant(object& value)
+			{
+				std::uint8_t type;
+				if (!take(type))
+					return false;
+
+				switch (static_cast<object::type>(type))
+				{
+					case object::type::NIL:
+						value = object{};
+						return true;
+
+					case object::type::BOOL:
+					{
+						std::uint8_t b;
+						if (!take(b))
+							return false;
+						value = object{b != 0};
+						return true;
+					}
+
+					case object::type::DOUBLE:
+					{
+						double d;
+						if (!take(d))
+							return false;
+						value = object{d};
+						return true;
+					}
+
+					case object::type::STRING:
+					{
+						std::string_view s;
+						if (!take_string(s))
+							return false;
+						value = object{s};
+						return true;
+					}
+
+					default:
+						return false;
+				}
+			}
+
+			bool align()
+			{
+				auto offset{static_cast<std::size_t>(p_ - begin_)};
+				auto padded{(offset + ALIGN - 1) / ALIGN * ALIGN};
+				if (padded > static_cast<std::size_t>(end_ - begin_))
+					return false;
+				p_ = begin_ + padded;
+				return true;
+			}
+
+		private:
+			char const* begin_;
+			char const* p_;
+			char const* end_;
+		};
+
+		// The symbol operands of a node, as references into the columns.
+		template<class Visit>
+		static void for_each_symbol(node_kind kind, std::uint32_t& a, std::uint32_t& b, std::uint32_t* params, std::size_t nparams, Visit&& visit)
+		{
+			switch (kind)
+			{
+				case node_kind::ASSIGN:
+				case node_kind::VARIABLE:
+				case node_kind::VAR:
+					visit(b);
+					break;
+
+				case node_kind::FUNCTION:
+					visit(a);
+					for (std::size_t i = 0; i < nparams; ++i)
+						visit(params[i]);
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		static file_columns symbols_to_file(ast const& tree)
+		{
+			file_columns columns{tree.a_, tree.b_, tree.lists_, {}};
+			std::unordered_map<symbol_id, std::uint32_t> index;
+
+			for (node_id n = 0; n < tree.size(); ++n)
+			{
+				auto kind{tree.kind(n)};
+				auto params{kind == node_kind::FUNCTION ? columns.lists.data() + tree.b(n) + 1 : nullptr};
+				auto nparams{kind == node_kind::FUNCTION ? columns.lists[tree.b(n)] : 0};
+
+				for_each_symbol(kind, columns.a[n], columns.b[n], params, nparams, [&](std::uint32_t& symbol)
+				{
+					auto [i, inserted] = index.try_emplace(symbol, static_cast<std::uint32_t>(columns.names.size()));
+					if (inserted)
+						columns.names.push_back(symbol_name(symbol));
+					symbol = i->second;
+				});
+			}
+
+			return columns;
+		}
+
+		static ast_ptr read(reader& r, cache_key key, source const& input)
+		{
+			header h;
+			if (!r.take(h)
+				|| std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0
+				|| h.byte_order != ORDER_MARK
+				|| h.format != ast_format_version
+				|| h.version != fnv1a(version)
+				|| cache_key{h.content_hash, h.content_size} != key)
+				return nullptr;
+
+			auto tree{std::make_shared<ast>()};
+			auto& t{*tree};
+			if (!r.take(t.kinds_, h.nodes)
+				|| !r.take(t.ops_, h.nodes)
+				|| !r.take(t.a_, h.nodes)
+				|| !r.take(t.b_, h.nodes)
+				|| !r.take(t.c_, h.nodes)
+				|| !r.take(t.where_, h.nodes)
+				|| !r.take(t.lists_, h.lists)
+				|| !r.take(t.locals_, h.locals))
+				return nullptr;
+
+			std::vector<symbol_id> symbols;
+			symbols.reserve(h.symbols);
+			for (std::uint32_t i = 0; i < h.symbols; ++i)
+			{
+				std::string_view name;
+				if (!r.take_string(name))
+					return nullptr;
+				symbols.push_back(intern(name));
+			}
+			if (!r.align())
+				return nullptr;
+
+			t.constants_.resize(h.constants);
+			for (auto& value : t.constants_)
+			{
+				if (!r.take_constant(value))
+					return nullptr;
+			}
+
+			t.roots_ = h.roots;
+			t.source_id_ = input.id();
+
+			if (!valid(t, h.symbols))
+				return nullptr;
+
+			for (node_id n = 0; n < t.size(); ++n)
+			{
+				auto kind{t.kinds_[n]};
+				auto params{kind == node_kind::FUNCTION ? t.lists_.data() + t.b_[n] + 1 : nullptr};
+				auto nparams{kind == node_kind::FUNCTION ? t.lists_[t.b_[n]] : 0};
+
+				for_each_symbol(kind, t.a_[n], t.b_[n], params, nparams, [&](std::uint32_t& symbol)
+				{
+					symbol = symbols[symbol];
+				});
+			}
+
+			return tree;
+		}
+
+		// Checks that every index in the file stays inside the tree and that
+		// children come before their parents, so a damaged file can neither
+		// send the evaluator out of bounds nor around a cycle.
+		static bool valid(ast const& t, std::uint32_t symbols)
+		{
+			auto const n{t.size()};
+			auto symbol = [symbols](std::uint32_t id) { return id < symbols; };
+			auto local = [&t](std::uint32_t id) { return id == global_slot || id < t.locals_.size(); };
+			auto list = [&t](std::uint32_t offset, auto&& each)
+			{
+				if (offset >= t.lists_.size() || t.lists_[offset] > t.lists_.size() - offset - 1)
+					return false;
+				for (auto item : t.list(offset))
+				{
+					if (!each(item))
+						return false;
+				}
+				return true;
+			};
+
+			if (!list(t.roots_, [n](std::uint32_t id) { return id < n; }))
+				return false;
+
+			for (node_id i = 0; i < n; ++i)
+			{
+				auto node = [i](std::uint32_t id) { return id < i; };
+				auto optional = [i](std::uint32_t id) { return id == no_node || id < i; };
+				auto a{t.a_[i]}, b{t.b_[i]}, c{t.c_[i]};
+				bool ok{false};
+				switch (t.kinds_[i])
+				{
+					case node_kind::ASSIGN: ok = node(a) && symbol(b) && local(c); break;
+					case node_kind::BINARY: ok = node(a) && node(b); break;
+					case node_kind::CALL: ok = node(a) && list(b, node); break;
+					case node_kind::GROUPING: ok = node(a); break;
+					case node_kind::LITERAL: ok = a < t.constants_.size(); break;
+					case node_kind::LOGICAL: ok = node(a) && node(b); break;
+					case node_kind::UNARY: ok = node(a); break;
+					case node_kind::VARIABLE: ok = symbol(b) && local(c); break;
+					case node_kind::BLOCK: ok = a <= 1 && list(b, node); break;
+					case node_kind::EXPRESSION: ok = node(a); break;
+					case node_kind::FOR: ok = optional(a) && node(b) && list(c, node) && (t.lists_[c] == 1 || t.lists_[c] == 2); break;
+					case node_kind::FUNCTION: ok = symbol(a) && list(b, symbol) && list(c, node); break;
+					case node_kind::IF: ok = node(a) && node(b) && optional(c); break;
+					case node_kind::PRINT: ok = node(a); break;
+					case node_kind::RETURN: ok = optional(a); break;
+					case node_kind::VAR: ok = optional(a) && symbol(b); break;
+					case node_kind::WHILE: ok = node(a) && node(b); break;
+				}
+				if (!ok)
+					return false;
+			}
+
+			return true;
+		}
+	};
+
+} // namespace lox::flat
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <cassert>
+#include <memory>
+#include <span>
+#include <string>
+
+#include "../callable.hpp"
+#include "../environment.hpp"
+#include "../exceptions.hpp"
+#include "../interpreter.hpp"
+#include "ast.hpp"
+
+namespace lox::flat
+{
+	// Runs a resolved ast on an interpreter's environments and value stack.
+	// Dispatch is a switch on the node kind; values are returned directly.
+	class evaluator
+	{
+	public:
+		using completion = interpreter::completion;
+
+		evaluator(interpreter& inter, ast const& tree)
+		: inter_{&inter}
+		, tree_{&tree}
+		{ }
+
+		void run()
+		{
+			for (auto stmt : tree_->roots())
+				(void)execute(stmt);
+		}
+
+		// Runs a FUNCTION node's body in an environment of its own.
+		object call(node_id function, environment_ptr const& closure, std::span<const object> arguments)
+		{
+			scope s{&inter_->stack(), closure};
+			ignore_unused(s);
+
+			auto params{tree_->list(tree_->b(function))};
+			assert(params.size() == arguments.size());
+
+			auto& env{inter_->current_env()};
+			for (std::size_t i = 0; i < params.size(); ++i)
+				env.define(params[i], arguments[i]);
+
+			if (execute_list(tree_->c(function)) == completion::returning)
+				return std::move(return_value_);
+
+			return {};
+		}
+
+	private:
+		interpreter* inter_;
+		ast const* tree_;
+		object return_value_;
+
+		[[nodiscard]] completion execute_list(std::uint32_t list)
+		{
+			for (auto stmt : tree_->list(list))
+			{
+				if (execute(stmt) == completion::returning)
+					return completion::returning;
+			}
+			return completion::normal;
+		}
+
+		// kept out of line so the dispatch loops stay small
+		[[noreturn, gnu::cold, gnu::noinline]]
+		static void unexpected(char const* what, int value)
+		{
+			LOX_THROW(programming_error, fmt::format("{}: {}", what, value));
+		}
+
+		[[nodiscard]] completion execute(node_id n);
+		[[nodiscard]] completion loop(node_id n);
+		object evaluate(node_id n);
+		object binary(node_id n);
+		object call(node_id n);
+	};
+
+	// A function declared by a FUNCTION node; keeps its ast alive.
+	class function_impl : public callable::impl
+	{
+	public:
+		function_impl(std::shared_ptr<ast const> tree, node_id declaration, environment_ptr closure)
+		: tree_{std::move(tree)}
+		, declaration_{declaration}
+		, closure_{std::move(closure)}
+		{
+			assert(closure_);
+			track();
+		}
+
+		std::size_t arity() const override
+		{
+			return tree_->list(tree_->b(declaration_)).size();
+		}
+
+		object call(interpreter& inter, std::span<const object> arguments) const override
+		{
+			return evaluator{inter, *tree_}.call(declaration_, closure_, arguments);
+		}
+
+		std::string name() const override
+		{
+			return std::string{symbol_name(tree_->a(declaration_))};
+		}
+
+		std::string str() const override
+		{ return fmt::format("<fn {}>", name()); }
+
+		void trace(tracer& t) const override
+		{ t(closure_.get()); }
+
+	protected:
+		void clear_references() override
+		{ closure_.reset(); }
+
+	private:
+		std::shared_ptr<ast const> tree_;
+		node_id declaration_;
+		environment_ptr closure_;
+	};
+
+	inline evaluator::completion evaluator::execute(node_id n)
+	{
+		auto const& t{*tree_};
+		switch (t.kind(n))
+		{
+			case node_kind::EXPRESSION:
+				(void)evaluate(t.a(n));
+				break;
+
+			case node_kind::PRINT:
+				inter_->output() << evaluate(t.a(n)).str() << std::endl;
+				break;
+
+			case node_kind::VAR:
+			{
+				object value;
+				if (t.a(n) != no_node)
+					value = evaluate(t.a(n));
+				inter_->current_env().define(t.b(n), std::move(value));
+				break;
+			}
+
+			case node_kind::BLOCK:
+			{
+				if (!t.a(n))
+					return execute_list(t.b(n));
+
+				scope s{&inter_->stack()};
+				ignore_unused(s);
+				return execute_list(t.b(n));
+			}
+
+			case node_kind::IF:
+				if (static_cast<bool>(evaluate(t.a(n))))
+					return execute(t.b(n));
+				if (t.c(n) != no_node)
+					return execute(t.c(n));
+				break;
+
+			case node_kind::WHILE:
+				while (static_cast<bool>(evaluate(t.a(n))))
+				{
+					if (execute(t.b(n)) == completion::returning)
+						return completion::returning;
+				}
+				break;
+
+			case node_kind::FOR:
+			{
+				if (t.a(n) == no_node)
+					return loop(n);
+
+				// one environment for every iteration
+				scope s{&inter_->stack()};
+				ignore_unused(s);
+				(void)execute(t.a(n));
+				return loop(n);
+			}
+
+			case node_kind::FUNCTION:
+			{
+				heap::get().maybe_collect();
+				callable func{make_ref<function_impl>(t.shared_from_this(), n, environment_ptr{&inter_->current_env()})};
+				inter_->current_env().define(t.a(n), object{func});
+				break;
+			}
+
+			case node_kind::RETURN:
+				return_value_ = t.a(n) != no_node ? evaluate(t.a(n)) : object{};
+				return completion::returning;
+
+			default:
+				unexpected("not a statement", static_cast<int>(t.kind(n)));
+		}
+
+		return completion::normal;
+	}
+
+	inline evaluator::completion evaluator::loop(node_id n)
+	{
+		auto const& t{*tree_};
+		auto rest{t.list(t.c(n))};
+		auto body{rest[0]};
+		auto increment{rest.size() > 1 ? rest[1] : no_node};
+
+		while (static_cast<bool>(evaluate(t.b(n))))
+		{
+			if (execute(body) == completion::returning)
+				return completion::returning;
+
+			if (increment != no_node)
+				(void)evaluate(increment);
+		}
+		return completion::normal;
+	}
+
+	inline object evaluator::evaluate(node_id n)
+	{
+		auto const& t{*tree_};
+		switch (t.kind(n))
+		{
+			case node_kind::LITERAL:
+				return t.constant(t.a(n));
+
+			case node_kind::GROUPING:
+				return evaluate(t.a(n));
+
+			case node_kind::VARIABLE:
+				if (auto local = t.local(n))
+					return inter_->current_env().get_at(local->depth, local->slot);
+				return inter_->global_env().get(t.b(n));
+
+			case node_kind::ASSIGN:
+			{
+				auto value{evaluate(t.a(n))};
+				if (auto local = t.local(n))
+					inter_->current_env().assign_at(local->depth, local->slot, value);
+				else
+					inter_->global_env().assign(t.b(n), value);
+				return value;
+			}
+
+			case node_kind::UNARY:
+			{
+				auto right{evaluate(t.a(n))};
+				switch (t.op(n))
+				{
+					case token_type::BANG: return !right;
+					case token_type::MINUS: return -right;
+					default:
+						unexpected("unsupported token", static_cast<int>(t.op(n)));
+				}
+			}
+
+			case node_kind::BINARY:
+				return binary(n);
+
+			case node_kind::LOGICAL:
+			{
+				auto left{evaluate(t.a(n))};
+				if (t.op(n) == token_type::OR ? static_cast<bool>(left) : !static_cast<bool>(left))
+					return left;
+				return evaluate(t.b(n));
+			}
+
+			case node_kind::CALL:
+				return call(n);
+
+			default:
+				unexpected("not an expression", static_cast<int>(t.kind(n)));
+		}
+	}
+
+	inline object evaluator::binary(node_id n)
+	{
+		auto left{evaluate(tree_->a(n))};
+		auto right{evaluate(tree_->b(n))};
+
+		switch (tree_->op(n))
+		{
+			case token_type::BANG_EQUAL: return object{left != right};
+			case token_type::EQUAL_EQUAL: return object{left == right};
+			case token_type::MINUS: return left - right;
+			case token_type::PLUS: return left + right;
+			case token_type::SLASH: return left / right;
+			case token_type::STAR: return left * right;
+			case token_type::GREATER: return object{left > right};
+			case token_type::GREATER_EQUAL: return object{left >= right};
+			case token_type::LESS: return object{left < right};
+			case token_type::LESS_EQUAL: return object{left <= right};
+			default:
+				unexpected("unhandled binary operator", static_cast<int>(tree_->op(n)));
+		}
+	}
+
+	inline object evaluator::call(node_id n)
+	{
+		auto args_list{tree_->list(tree_->b(n))};
+		auto callee{evaluate(tree_->a(n))};
+
+		interpreter::value_frame args{*inter_, args_list.size()};
+		for (auto arg : args_list)
+			args.push(evaluate(arg));
+
+		auto func{callee.as_callable()};
+		if (func == nullptr)
+			throw type_error{"Only functions and classes are callable."};
+
+		if (args_list.size() != func->arity())
+			throw runtime_error{
+				fmt::format("Exepcted {} arguments but got {}.", func->arity(), args_list.size())
+			};
+
+		return func->call(*inter_, args.values());
+	}
+
+} // namespace lox::flat
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../token.hpp"
+#include "ast.hpp"
+
+namespace lox::flat
+{
+	// Binds every local VARIABLE and ASSIGN in an ast to its slot, with the
+	// same rules and diagnostics as lox::resolver has for the pointer tree.
+	class resolver
+	{
+		struct binding
+		{
+			bool defined;
+			std::uint32_t slot;
+		};
+
+		using scope_t = std::unordered_map<symbol_id, binding>;
+
+		enum class function_type
+		{
+			NONE,
+			FUNCTION
+		};
+
+	public:
+		explicit resolver(std::ostream& error)
+		: error_{&error}
+		{ }
+
+		bool had_error() const { return had_error_; }
+
+		void resolve(ast& tree)
+		{
+			tree_ = &tree;
+			for (auto stmt : tree.roots())
+				resolve(stmt);
+			tree_ = nullptr;
+		}
+
+	private:
+		std::ostream* error_;
+		ast* tree_ = nullptr;
+		std::vector<scope_t> scopes_;
+		function_type current_function_ = function_type::NONE;
+		bool had_error_ = false;
+
+		void resolve_list(std::uint32_t list)
+		{
+			for (auto n : tree_->list(list))
+				resolve(n);
+		}
+
+		void resolve(node_id n)
+		{
+			auto& t{*tree_};
+			switch (t.kind(n))
+			{
+				case node_kind::ASSIGN:
+					resolve(t.a(n));
+					resolve_local(n, t.b(n));
+					break;
+
+				case node_kind::BINARY:
+				case node_kind::LOGICAL:
+				case node_kind::WHILE:
+					resolve(t.a(n));
+					resolve(t.b(n));
+					break;
+
+				case node_kind::CALL:
+					resolve(t.a(n));
+					resolve_list(t.b(n));
+					break;
+
+				case node_kind::GROUPING:
+				case node_kind::UNARY:
+				case node_kind::EXPRESSION:
+				case node_kind::PRINT:
+					resolve(t.a(n));
+					break;
+
+				case node_kind::LITERAL:
+					break;
+
+				case node_kind::VARIABLE:
+					if (!scopes_.empty())
+					{
+						auto i{scopes_.back().find(t.b(n))};
+						if (i != scopes_.back().end() && !i->second.defined)
+							error(n, "Cannot read local variable in its own initializer.");
+					}
+					resolve_local(n, t.b(n));
+					break;
+
+				case node_kind::BLOCK:
+					if (!t.a(n))
+					{
+						resolve_list(t.b(n));
+						break;
+					}
+					scopes_.emplace_back();
+					resolve_list(t.b(n));
+					scopes_.pop_back();
+					break;
+
+				case node_kind::FOR:
+					if (t.a(n) != no_node)
+					{
+						scopes_.emplace_back();
+						resolve(t.a(n));
+					}
+					resolve(t.b(n));
+					resolve_list(t.c(n));
+					if (t.a(n) != no_node)
+						scopes_.pop_back();
+					break;
+
+				case node_kind::FUNCTION:
+					declare(n, t.a(n));
+					define(t.a(n));
+					resolve_function(n, function_type::FUNCTION);
+					break;
+
+				case node_kind::IF:
+					resolve(t.a(n));
+					resolve(t.b(n));
+					if (t.c(n) != no_node)
+						resolve(t.c(n));
+					break;
+
+				case node_kind::RETURN:
+					if (current_function_ == function_type::NONE)
+						error(n, "Cannot return from top-level code.");
+					if (t.a(n) != no_node)
+						resolve(t.a(n));
+					break;
+
+				case node_kind::VAR:
+					declare(n, t.b(n));
+					if (t.a(n) != no_node)
+						resolve(t.a(n));
+					define(t.b(n));
+					break;
+			}
+		}
+
+		void declare(node_id n, symbol_id name)
+		{
+			if (scopes_.empty())
+				return;
+
+			auto& scope{scopes_.back()};
+			const binding b{false, static_cast<std::uint32_t>(scope.size())};
+			auto [_, inserted] = scope.emplace(name, b);
+			if (!inserted)
+				error(n, "Already a variable with this name in this scope.");
+		}
+
+		void define(symbol_id name)
+		{
+			if (scopes_.empty())
+				return;
+
+			auto i{scopes_.back().find(name)};
+			assert(i != scopes_.back().end());
+			i->second.defined = true;
+		}
+
+		void resolve_local(node_id n, symbol_id name)
+		{
+			for (std::size_t i = scopes_.size(); i > 0; --i)
+			{
+				auto&& scope{scopes_[i - 1]};
+				auto b{scope.find(name)};
+				if (b != scope.end())
+				{
+					const auto depth{static_cast<std::uint32_t>(scopes_.size() - i)};
+					tree_->resolve(n, local_slot{depth, b->second.slot});
+					return;
+				}
+			}
+		}
+
+		void resolve_function(node_id n, function_type type)
+		{
+			auto enclosing_function{current_function_};
+			current_function_ = type;
+
+			scopes_.emplace_back();
+			for (auto param : tree_->list(tree_->b(n)))
+			{
+				declare(n, param);
+				define(param);
+			}
+			resolve_list(tree_->c(n));
+			scopes_.pop_back();
+
+			current_function_ = enclosing_function;
+		}
+
+		void error(node_id n, std::string_view message)
+		{
+			had_error_ = true;
+			auto const& where{source::from_id(tree_->source_id())};
+			::lox::log_error(*error_, token{token_type::IDENTIFIER, where, tree_->where(n), 0}, message);
+		}
+	};
+
+} // namespace lox::flat
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lox
+{
+	class gc_object;
+
+	// Receives every counted reference a gc_object holds to another gc_object.
+	class tracer
+	{
+	public:
+		virtual ~tracer() = default;
+		virtual void visit(gc_object const& ref) = 0;
+
+		void operator()(gc_object const* ref)
+		{
+			if (ref)
+				visit(*ref);
+		}
+	};
+
+	// Intrusively reference counted base for everything the interpreter
+	// allocates at runtime. Acyclic objects (strings, builtins) are freed by
+	// their count alone; objects that can take part in a cycle (environments,
+	// functions, closures) are also tracked by the heap's collector.
+	class gc_object
+	{
+		friend class heap;
+
+	public:
+		gc_object() = default;
+
+		gc_object(gc_object const&) = delete;
+		gc_object& operator=(gc_object const&) = delete;
+
+		virtual ~gc_object();
+
+		void add_ref() const { ++refs_; }
+
+		void release() const
+		{
+			assert(refs_ > 0);
+			if (--refs_ == 0)
+				delete this;
+		}
+
+		std::uint32_t use_count() const { return refs_; }
+		bool tracked() const { return heap_index_ != UNTRACKED; }
+
+		// Report each counted reference this object holds.
+		virtual void trace(tracer& t) const { (void)t; }
+
+	protected:
+		// Registers the object with the collector. Only objects whose trace()
+		// reports all their references may be tracked.
+		void track();
+
+		// Drop every reference reported by trace(); only called on garbage.
+		virtual void clear_references() { }
+
+	private:
+		static constexpr std::uint32_t UNTRACKED = std::numeric_limits<std::uint32_t>::max();
+
+		mutable std::uint32_t refs_ = 0;
+		mutable std::int32_t gc_refs_ = 0;
+		std::uint32_t heap_index_ = UNTRACKED;
+	};
+
+	// Mark-sweep cycle collector over the tracked gc_objects.
+	//
+	// The interpreter's roots (the scope_stack, the globals, and values held
+	// in native temporaries while an expression is evaluated) are exactly the
+	// references that don't come from another tracked object, so rather than
+	// enumerating them the collector finds them by subtracting internal
+	// references from each reference count. Everything reachable from an
+	// object with references left over is marked; the rest is unreachable
+	// cycles, which are broken and freed.
+	class heap
+	{
+		friend class gc_object;
+
+		static constexpr std::size_t MIN_THRESHOLD = 1024;
+
+	public:
+		// One heap per process: the interpreter is single threaded.
+		static heap& get()
+		{
+			static heap instance;
+			return instance;
+		}
+
+		heap(heap const&) = delete;
+		heap& operator=(heap const&) = delete;
+
+		std::size_t tracked() const { return tracked_.size(); }
+
+		// Collects once enough tracked objects have been allocated since the
+		// last collection. Call before allocating, never while an object under
+		// construction is reachable only through raw pointers.
+		void maybe_collect()
+		{
+			if (tracked_.size() >= next_collection_)
+				collect();
+		}
+
+		// Returns the number of objects freed.
+		std::size_t collect()
+		{
+			if (collecting_)
+				return 0;
+			collecting_ = true;
+
+			// count references that come from outside the tracked set
+			for (auto obj : tracked_)
+				obj->gc_refs_ = static_cast<std::int32_t>(obj->refs_);
+
+			struct : tracer
+			{
+				void visit(gc_object const& ref) override
+				{
+					if (ref.tracked())
+						--ref.gc_refs_;
+				}
+			} subtract;
+
+			for (auto obj : tracked_)
+				obj->trace(subtract);
+
+			// mark everything reachable from those roots
+			struct marker : tracer
+			{
+				std::vector<gc_object const*> pending;
+
+				void visit(gc_object const& ref) override
+				{
+					if (ref.tracked() && ref.gc_refs_ != REACHABLE)
+					{
+						ref.gc_refs_ = REACHABLE;
+						pending.push_back(&ref);
+					}
+				}
+			} mark;
+
+			for (auto obj : tracked_)
+			{
+				if (obj->gc_refs_ > 0)
+					mark.visit(*obj);
+			}
+
+			while (!mark.pending.empty())
+			{
+				auto obj{mark.pending.back()};
+				mark.pending.pop_back();
+				obj->trace(mark);
+			}
+
+			// sweep: hold the garbage alive while its cycles are broken
+			std::vector<gc_object*> garbage;
+			for (auto obj : tracked_)
+			{
+				if (obj->gc_refs_ != REACHABLE)
+				{
+					obj->add_ref();
+					garbage.push_back(obj);
+				}
+			}
+
+			for (auto obj : garbage)
+				obj->clear_references();
+
+			for (auto obj : garbage)
+				obj->release();
+
+			next_collection_ = std::max(MIN_THRESHOLD, 2 * tracked_.size());
+			collecting_ = false;
+			return garbage.size();
+		}
+
+	private:
+		static constexpr std::int32_t REACHABLE = -1;
+
+		std::vector<gc_object*> tracked_;
+		std::size_t next_collection_ = MIN_THRESHOLD;
+		bool collecting_ = false;
+
+		heap() = default;
+
+		void track(gc_object& obj)
+		{
+			assert(!obj.tracked());
+			obj.heap_index_ = static_cast<std::uint32_t>(tracked_.size());
+			tracked_.push_back(&obj);
+		}
+
+		void untrack(gc_object& obj)
+		{
+			assert(obj.tracked());
+			assert(tracked_[obj.heap_index_] == &obj);
+
+			auto last{tracked_.back()};
+			last->heap_index_ = obj.heap_index_;
+			tracked_[obj.heap_index_] = last;
+			tracked_.pop_back();
+			obj.heap_index_ = gc_object::UNTRACKED;
+		}
+	};
+
+	inline gc_object::~gc_object()
+	{
+		if (tracked())
+			heap::get().untrack(*this);
+	}
+
+	inline void gc_object::track()
+	{
+		heap::get().track(*this);
+	}
+
+
+	// Intrusive counterpart of std::shared_ptr for gc_object types.
+	template<class T>
+	class ref_ptr
+	{
+		template<class U>
+		friend class ref_ptr;
+
+	public:
+		ref_ptr() = default;
+
+		explicit ref_ptr(T* ptr)
+		: ptr_{ptr}
+		{
+			if (ptr_)
+				ptr_->add_ref();
+		}
+
+		ref_ptr(ref_ptr const& copy)
+		: ref_ptr{copy.ptr_}
+		{ }
+
+		ref_ptr(ref_ptr&& from) noexcept
+		: ptr_{std::exchange(from.ptr_, nullptr)}
+		{ }
+
+		template<class U>
+		ref_ptr(ref_ptr<U> const& copy)
+		: ref_ptr{static_cast<T*>(copy.ptr_)}
+		{ }
+
+		template<class U>
+		ref_ptr(ref_ptr<U>&& from) noexcept
+		: ptr_{std::exchange(from.ptr_, nullptr)}
+		{ }
+
+		~ref_ptr()
+		{
+			if (ptr_)
+				ptr_->release();
+		}
+
+		ref_ptr& operator=(ref_ptr copy) noexcept
+		{
+			std::swap(ptr_, copy.ptr_);
+			return *this;
+		}
+
+		void reset() { ref_ptr{}.swap(*this); }
+		void swap(ref_ptr& other) noexcept { std::swap(ptr_, other.ptr_); }
+
+		T* get() const { return ptr_; }
+		T& operator*() const { assert(ptr_); return *ptr_; }
+		T* operator->() const { assert(ptr_); return ptr_; }
+		explicit operator bool() const { return ptr_ != nullptr; }
+
+	private:
+		T* ptr_ = nullptr;
+	};
+
+	template<class T, class... Args>
+	ref_ptr<T> make_ref(Args&&... args)
+	{ return ref_ptr<T>{new T(std::forward<Args>(args)...)}; }
+
+
+	// Base of every value that an object refers to by pointer rather than
+	// storing inline.
+	class heap_object : public gc_object
+	{
+	public:
+		enum class kind : std::uint8_t
+		{
+			STRING,
+			CALLABLE
+		};
+
+		explicit heap_object(kind k)
+		: kind_{k}
+		{ }
+
+		kind get_kind() const { return kind_; }
+
+	private:
+		kind kind_;
+	};
+
+	// Immutable string payload; copying a string object only bumps the count.
+	class string_object final : public heap_object
+	{
+	public:
+		explicit string_object(std::string value)
+		: heap_object{kind::STRING}
+		, value_{std::move(value)}
+		{ }
+
+		std::string const& value() const { return value_; }
+
+	private:
+		std::string value_;
+	};
+
+} // namespace lox
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
+#include <memory>
 #include <ranges>
+#include <span>
 
 #include "environment.hpp"
 #include "exceptions.hpp"
@@ -13,7 +16,7 @@
 namespace lox {
 
 class interpreter
-	: public expression::visitor
+	: public expression::value_visitor
 	, public statement::visitor
 {
 	std::istream* stdin_;
@@ -22,9 +25,13 @@ class interpreter
 
 public:
 
-	struct return_value
+	// How a statement finished. A `return` unwinds by reporting `returning`
+	// up through every enclosing statement until the function call that
+	// consumes it with take_return_value().
+	enum class completion : std::uint8_t
 	{
-		object value_;
+		normal,
+		returning
 	};
 
 	using statement_vec = std::vector<statement_ptr>;
@@ -44,28 +51,134 @@ public:
 
 		for (auto&& callable : callable::builtins())
 		{
-			global_env().define(callable.name(), object{std::move(callable)});
+			global_env().define(intern(callable.name()), object{std::move(callable)});
 		}
 	}
 
+	interpreter(interpreter const&) = delete;
+	interpreter& operator=(interpreter const&) = delete;
+
+	~interpreter()
+	{
+		// the globals usually sit in a cycle with the functions defined there
+		return_value_ = object{};
+		stack_.clear();
+		heap::get().collect();
+	}
+
 	scope_stack& stack() { return stack_; }
 	environment& global_env() { return stack_.global(); }
 	environment& current_env() { return stack_.current(); }
+	std::ostream& output() const { return *stdout_; }
 
-	void resolve(expression const& expr, size_t depth)
+	void resolve(expression const& expr, local_slot slot)
 	{
-		locals_.insert_or_assign(&expr, depth);
+		switch (expr.type())
+		{
+			case expression_type::VARIABLE:
+				static_cast<variable const&>(expr).resolve(slot);
+				break;
+
+			case expression_type::ASSIGN:
+				static_cast<assign const&>(expr).resolve(slot);
+				break;
+
+			default:
+				LOX_THROW(programming_error, fmt::format("cannot resolve expression type: {}", static_cast<int>(expr.type())));
+		}
 	}
 
 	void interpret(statement_vec const& statements)
 	{
-		execute_block(statements);
+		completion_ = completion::normal;
+		(void)execute_block(statements);
+		completion_ = completion::normal;
 	}
 
-	void execute_block(block_stmt::statements_t const& statements)
+	[[nodiscard]] completion execute_block(block_stmt::statements_t const& statements)
 	{
 		for (auto&& stmt : statements)
-			execute(*stmt);
+		{
+			if (execute(*stmt) == completion::returning)
+				return completion::returning;
+		}
+		return completion::normal;
+	}
+
+	object take_return_value()
+	{
+		assert(completion_ == completion::returning);
+		completion_ = completion::normal;
+		return std::move(return_value_);
+	}
+
+	// Reserves room on the value stack for one call's arguments and
+	// releases it, values included, when the call is done.
+	class value_frame
+	{
+	public:
+		value_frame(interpreter& inter, std::size_t count)
+		: inter_{&inter}
+		, base_{inter.values_top_}
+		{
+			if (count > static_cast<std::size_t>(inter.values_.get() + VALUE_STACK_MAX - base_))
+				throw runtime_error{"Stack overflow."};
+		}
+
+		value_frame(value_frame const&) = delete;
+		value_frame& operator=(value_frame const&) = delete;
+
+		~value_frame()
+		{
+			while (inter_->values_top_ > base_)
+				*--inter_->values_top_ = object{};
+		}
+
+		void push(object value) { *inter_->values_top_++ = std::move(value); }
+
+		std::span<const object> values() const
+		{ return {base_, static_cast<std::size_t>(inter_->values_top_ - base_)}; }
+
+	private:
+		interpreter* inter_;
+		object* base_;
+	};
+
+	// The frame of one call to a Lox function: room on the value stack for
+	// the locals the resolver didn't find captured. Leaving it restores
+	// the caller's frame.
+	class call_frame
+	{
+	public:
+		call_frame(interpreter& inter, std::size_t size)
+		: values_{inter, size}
+		, inter_{&inter}
+		, enclosing_{inter.frame_}
+		{
+			for (std::size_t i = 0; i < size; ++i)
+				values_.push({});
+			inter.frame_ = inter.values_top_ - size;
+		}
+
+		call_frame(call_frame const&) = delete;
+		call_frame& operator=(call_frame const&) = delete;
+
+		~call_frame() { inter_->frame_ = enclosing_; }
+
+	private:
+		value_frame values_;
+		interpreter* inter_;
+		object* enclosing_;
+	};
+
+	// Gives a local its value where the resolver put it: the running
+	// call's frame, or the current environment.
+	void define(std::optional<local_slot> const& local, symbol_id name, object value)
+	{
+		if (local && local->in_frame())
+			frame_[local->slot] = std::move(value);
+		else
+			current_env().define(name, std::move(value));
 	}
 
 
@@ -88,40 +201,79 @@ public:
 		if (stmt.initializer())
 			value = evaluate(*stmt.initializer());
 
-		current_env().define(std::string{stmt.name().lexeme()}, std::move(value));
+		define(stmt.local(), stmt.name().symbol(), std::move(value));
 	}
 
 	void visit(block_stmt const& stmt) override
 	{
+		if (!stmt.has_scope())
+		{
+			(void)execute_block(stmt.statements());
+			return;
+		}
+
 		scope s{&stack_};
 		ignore_unused(s);
 
-		execute_block(stmt.statements());
+		(void)execute_block(stmt.statements());
 	}
 
 	void visit(if_stmt const& stmt) override
 	{
 		bool condition{evaluate(stmt.condition())};
 		if (condition)
-			execute(stmt.then_branch());
+			(void)execute(stmt.then_branch());
 		else if (auto&& else_branch = stmt.else_branch())
-			execute(*else_branch);
+			(void)execute(*else_branch);
 	}
 
 	void visit(while_stmt const& stmt) override
 	{
 		while (static_cast<bool>(evaluate(stmt.condition())))
-			execute(stmt.body());
+		{
+			if (execute(stmt.body()) == completion::returning)
+				return;
+		}
+	}
+
+	void visit(for_stmt const& stmt) override
+	{
+		auto&& initializer{stmt.initializer()};
+		if (initializer && stmt.has_scope())
+		{
+			// one environment for every iteration
+			scope s{&stack_};
+			ignore_unused(s);
+
+			(void)execute(*initializer);
+			loop(stmt);
+		}
+		else
+		{
+			if (initializer)
+				(void)execute(*initializer);
+			loop(stmt);
+		}
+	}
+
+	void loop(for_stmt const& stmt)
+	{
+		while (static_cast<bool>(evaluate(stmt.condition())))
+		{
+			if (execute(stmt.body()) == completion::returning)
+				return;
+
+			if (auto&& increment = stmt.increment())
+				(void)evaluate(*increment);
+		}
 	}
 
 	void visit(func_stmt const& stmt) override
 	{
-		ignore_unused(stmt);
-		auto func{callable::make_lox_function(stmt, stack_.current().shared_from_this())};
-		current_env().define(std::string{stmt.name().lexeme()}, object{func});
+		auto func{callable::make_lox_function(stmt, environment_ptr{&stack_.current()})};
+		define(stmt.local(), stmt.name().symbol(), object{func});
 	}
 
-	[[noreturn]]
 	void visit(return_stmt const& stmt) override
 	{
 		object value;
@@ -130,199 +282,226 @@ public:
 		if (expr)
 			value = evaluate(*expr);
 
-		throw return_value{std::move(value)};
+		return_value_ = std::move(value);
+		completion_ = completion::returning;
 	}
 
 
 	// expressions
-	object const& result() const { return result_; }
-
 
-	void visit(unary const& unary) override
+	object visit(unary const& unary) override
 	{
 		auto right = evaluate(unary.right());
 
-		switch(unary.op_token().type())
+		switch (unary.op())
 		{
-			case token_type::BANG:
-				result_ = !right;
-				break;
-				
-			case token_type::MINUS:
-				result_ = -right;
-				break;
-		
-			default:
-				throw programming_error{
-					fmt::format(
-						"unsupported token: {}",
-						static_cast<int>(unary.op_token().type())
-					)
-				};		
+			case unary_op::NOT: return !right;
+			case unary_op::NEGATE: return -right;
 		}
+		LOX_THROW(programming_error, fmt::format("unsupported unary operator: '{}'", unary.op_token().lexeme()));
 	}
 
-	void visit(binary const& binary) override
+	object visit(binary const& binary) override
 	{
 		auto left{evaluate(binary.left())};
 		auto right{evaluate(binary.right())};
 
-		switch(binary.op_token().type())
+		switch (binary.profile())
 		{
-			case token_type::BANG_EQUAL:
-				result_ = object{left != right};
+			case operand_profile::NUMBERS:
+				if (left.is_double() && right.is_double())
+					return numeric(binary.op(), left.as_number(), right.as_number());
+				binary.specialize(operand_profile::GENERIC);
 				break;
 
-			case token_type::EQUAL_EQUAL:
-				result_ = object{left == right};
+			case operand_profile::STRINGS:
+				if (auto l = left.as_string(), r = right.as_string(); l && r)
+					return object{(l->value() == r->value()) == (binary.op() == binary_op::EQUAL)};
+				binary.specialize(operand_profile::GENERIC);
 				break;
 
-			case token_type::MINUS:
-				result_ = left - right;
+			case operand_profile::UNSEEN:
+				binary.specialize(profile_of(binary.op(), left, right));
 				break;
 
-			case token_type::PLUS:
-				result_ = left + right;
+			case operand_profile::GENERIC:
 				break;
 
-			case token_type::SLASH:
-				result_ = left / right;
-				break;
-
-			case token_type::STAR:
-				result_ = left * right;
-				break;
-
-			case token_type::GREATER:
-				result_ = object{left > right};
-				break;
-
-			case token_type::GREATER_EQUAL:
-				result_ = object{left >= right};
-				break;
+			case operand_profile::PROVEN_NUMBERS:
+				return numeric(binary.op(), left.as_number(), right.as_number());
 
-			case token_type::LESS:
-				result_ = object{left < right};
-				break;
-
-			case token_type::LESS_EQUAL:
-				result_ = object{left <= right};
-				break;
+			case operand_profile::PROVEN_STRINGS:
+				assert(left.as_string() && right.as_string());
+				return object{(left.as_string()->value() == right.as_string()->value()) == (binary.op() == binary_op::EQUAL)};
+		}
 
-			default:
-				LOX_THROW(programming_error, fmt::format("unhandled binary operator: '{}'", binary.op_token().lexeme()));
+		switch (binary.op())
+		{
+			case binary_op::NOT_EQUAL: return object{left != right};
+			case binary_op::EQUAL: return object{left == right};
+			case binary_op::SUBTRACT: return left - right;
+			case binary_op::ADD: return left + right;
+			case binary_op::DIVIDE: return left / right;
+			case binary_op::MULTIPLY: return left * right;
+			case binary_op::GREATER: return object{left > right};
+			case binary_op::GREATER_EQUAL: return object{left >= right};
+			case binary_op::LESS: return object{left < right};
+			case binary_op::LESS_EQUAL: return object{left <= right};
 		}
+		LOX_THROW(programming_error, fmt::format("unhandled binary operator: '{}'", binary.op_token().lexeme()));
 	}
 
-	void visit(call const& call) override
+	object visit(call const& call) override
 	{
 		const auto nargs{call.arguments().size()};
 		auto callee{evaluate(call.callee())};
-		std::vector<object> args;
-		args.reserve(nargs);
 
-		std::ranges::copy(
-			std::views::transform(call.arguments(), [this](auto const& exp) { return evaluate(*exp); }),
-			std::back_inserter(args)
-		);
+		// arguments are evaluated onto the value stack and handed to the
+		// callee in place; nested calls push above them and pop on the way out
+		value_frame args{*this, nargs};
+		for (auto&& arg : call.arguments())
+			args.push(evaluate(*arg));
 
-		callable func;
-
-		try
-		{
-			func = callee.get<callable>();
-		}
-		catch(type_error const&)
-		{
+		auto func{callee.as_callable()};
+		if (func == nullptr)
 			throw type_error{"Only functions and classes are callable."};
-		}
-
-		assert(func.valid());
 
-		if (nargs != func.arity())
+		if (nargs != func->arity())
 			throw runtime_error{
-				fmt::format("Exepcted {} arguments but got {}.", func.arity(), nargs)
+				fmt::format("Exepcted {} arguments but got {}.", func->arity(), nargs)
 			};
-			
-		result_ = func(*this, args);
+
+		return func->call(*this, args.values());
 	}
 
-	void visit(logical const& logical) override
+	object visit(logical const& logical) override
 	{
 		object left{evaluate(logical.left())};
 
-		if (logical.op_token().type() == token_type::OR)
+		if (logical.op() == logical_op::OR)
 		{
 			if (static_cast<bool>(left))
-			{
-				result_ = left;
-				return;
-			}
+				return left;
 		}
 		else
 		{
 			if (!static_cast<bool>(left))
-			{
-				result_ = left;
-				return;
-			}
+				return left;
 		}
 
-		result_ = evaluate(logical.right());
+		return evaluate(logical.right());
 	}
 
-	void visit(grouping const& grouping) override
+	object visit(grouping const& grouping) override
 	{
-		result_ = evaluate(grouping.expr());
+		return evaluate(grouping.expr());
 	}
 
-	void visit(literal const& literal) override
+	object visit(literal const& literal) override
 	{
-		result_ = literal.value();
+		return literal.value();
 	}
 
-	void visit(variable const& variable) override
+	object visit(variable const& variable) override
 	{
-		result_ = lookup_variable(variable.name_token(), variable);
+		if (auto&& local = variable.local())
+			return local->in_frame() ? frame_[local->slot] : current_env().get_at(local->depth, local->slot);
+		return global_env().get(variable.symbol());
 	}
 
-	void visit(assign const& expr) override
+	object visit(assign const& expr) override
 	{
 		auto value = evaluate(expr.value());
-		auto i{locals_.find(&expr)};
-		if (i == locals_.end())
-			global_env().assign(expr.name(), std::move(value));
+		if (auto&& local = expr.local())
+		{
+			if (local->in_frame())
+				frame_[local->slot] = value;
+			else
+				current_env().assign_at(local->depth, local->slot, value);
+		}
 		else
-			current_env().assign_at(i->second, expr.name_token(), std::move(value));
+			global_env().assign(expr.symbol(), value);
 
-		result_ = value;
+		return value;
 	}
 
 private:
-	object result_;
-	scope_stack stack_;
+	// What a binary node should specialize to after seeing these operands.
+	static operand_profile profile_of(binary_op op, object const& left, object const& right)
+	{
+		if (left.is_double() && right.is_double())
+			return operand_profile::NUMBERS;
 
-	using locals_t = std::unordered_map<expression const*, std::size_t>;
-	locals_t locals_;
+		auto const equality{op == binary_op::EQUAL || op == binary_op::NOT_EQUAL};
+		if (equality && left.as_string() && right.as_string())
+			return operand_profile::STRINGS;
 
-	object lookup_variable(token const& name, expression const& expr)
+		return operand_profile::GENERIC;
+	}
+
+	// The binary operators on two numbers, for nodes specialized to them.
+	[[gnu::always_inline]]
+	static object numeric(binary_op op, double left, double right)
 	{
-		auto i{locals_.find(&expr)};
-		if (i == locals_.end())
-			return global_env().get(std::string{name.lexeme()});
-		else
-			return current_env().get_at(i->second, std::string{name.lexeme()});
+		switch (op)
+		{
+			case binary_op::NOT_EQUAL: return object{left != right};
+			case binary_op::EQUAL: return object{left == right};
+			case binary_op::SUBTRACT: return object{left - right};
+			case binary_op::ADD: return object{left + right};
+			case binary_op::DIVIDE: return object{left / right};
+			case binary_op::MULTIPLY: return object{left * right};
+			case binary_op::GREATER: return object{left > right};
+			case binary_op::GREATER_EQUAL: return object{left >= right};
+			case binary_op::LESS: return object{left < right};
+			case binary_op::LESS_EQUAL: return object{left <= right};
+		}
+		LOX_THROW(programming_error, fmt::format("unhandled binary operator: {}", static_cast<int>(op)));
 	}
 
+	static constexpr std::size_t VALUE_STACK_MAX = 64 * 1024;
+
+	std::unique_ptr<object[]> values_{std::make_unique<object[]>(VALUE_STACK_MAX)};
+	object* values_top_{values_.get()};
+	object* frame_ = nullptr;
+	object return_value_;
+	completion completion_ = completion::normal;
+	scope_stack stack_;
+
+	// Goes through accept() and the visit() it calls. Build with
+	// LOX_SWITCH_DISPATCH to switch on the node's kind and call the visits
+	// directly instead; on the benchmarks so far that has been no faster, as
+	// every evaluation shares the switch's one indirect jump.
 	object evaluate(expression const& expr)
 	{
-		expr.accept(*this);
-		return result();
+#ifndef LOX_SWITCH_DISPATCH
+		return expr.accept(*this);
+#else
+		switch (expr.type())
+		{
+			case expression_type::ASSIGN: return interpreter::visit(static_cast<assign const&>(expr));
+			case expression_type::BINARY: return interpreter::visit(static_cast<binary const&>(expr));
+			case expression_type::CALL: return interpreter::visit(static_cast<call const&>(expr));
+			case expression_type::GROUPING: return interpreter::visit(static_cast<grouping const&>(expr));
+			case expression_type::LITERAL: return interpreter::visit(static_cast<literal const&>(expr));
+			case expression_type::LOGICAL: return interpreter::visit(static_cast<logical const&>(expr));
+			case expression_type::UNARY: return interpreter::visit(static_cast<unary const&>(expr));
+			case expression_type::VARIABLE: return interpreter::visit(static_cast<variable const&>(expr));
+		}
+		unexpected_expression(expr.type());
+#endif
+	}
+
+	[[noreturn, gnu::cold, gnu::noinline]]
+	static void unexpected_expression(expression_type type)
+	{
+		LOX_THROW(programming_error, fmt::format("unexpected expression type: {}", static_cast<int>(type)));
 	}
 
-	void execute(statement const& stmt)
+	[[nodiscard]] completion execute(statement const& stmt)
 	{
 		stmt.accept(*this);
+		return completion_;
 	}
 };
 
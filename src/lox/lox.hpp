@@ -1,16 +1,37 @@
 #pragma once
 
+#include <exception>
+#include <filesystem>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
 #include "ast_printer.hpp"
+#include "channel.hpp"
 #include "expr.hpp"
+#include "flat/ast.hpp"
+#include "flat/cache.hpp"
+#include "flat/evaluator.hpp"
+#include "flat/resolver.hpp"
 #include "interpreter.hpp"
+#include "optimizer.hpp"
 #include "parser.hpp"
 #include "resolver.hpp"
 #include "scanner.hpp"
 #include "source_file.hpp"
+#include "token_stream.hpp"
+#include "vm/compiler.hpp"
+#include "vm/machine.hpp"
 
 namespace lox {
 
+	enum class engine
+	{
+		tree_walker,
+		vm,
+		flat
+	};
+
 	class Lox
 	{
 	public:
@@ -24,6 +45,7 @@ namespace lox {
 		, stdout_{stdout == nullptr ? &std::cout : stdout}
 		, stderr_{stderr == nullptr ? &std::cerr : stderr}
 		, interpreter_{stdin_, stdout_, stderr_}
+		, machine_{interpreter_, *stdout_}
 		{
 			assert(stdin_);
 			assert(stdout_);
@@ -33,10 +55,10 @@ namespace lox {
 		~Lox(){}
 
 		Lox(Lox const&) = delete;
-		Lox(Lox&&) = default;
+		Lox(Lox&&) = delete; // the machine's closures point at it
 
 		Lox& operator=(Lox const&) = delete;
-		Lox& operator=(Lox&&) = default;
+		Lox& operator=(Lox&&) = delete;
 
 		std::istream& stdin() const { return *stdin_; }
 		std::ostream& stdout() const { return *stdout_; }
@@ -46,34 +68,176 @@ namespace lox {
 		bool had_parse_error() const { return had_parse_error_; }
 		bool had_runtime_error() const { return had_runtime_error_; }
 
-		void run(source& input)
+		lox::engine engine() const { return engine_; }
+		void engine(lox::engine e) { engine_ = e; }
+
+		void run(source const& input)
+		{
+			run(input, nullptr);
+		}
+
+		// Runs an input that nothing else keeps alive. It is released when
+		// the run ends, unless a function it defines still refers to it.
+		void run(std::shared_ptr<source const> input)
+		{
+			auto const& s{*input};
+			run(s, std::move(input));
+		}
+
+		// Runs stdin a line at a time until it ends.
+		void run_prompt()
+		{
+			stdout() << "lox REPL. Enter EOF to stop." << std::endl;
+
+			// lines no function refers to are released, so their source ids
+			// can be reused
+			for (std::string line; stdout() << "> " << std::flush, std::getline(stdin(), line); )
+				run(std::make_shared<string_source>("<stdin>", std::move(line)));
+
+			stdout() << "stopped." << std::endl;
+		}
+
+		// Runs each top-level declaration as soon as it has been parsed and
+		// resolved. Scanning, parsing and resolving run on a second thread a
+		// few declarations ahead of execution. Each declaration gets its own
+		// compilation unit, which is freed after it runs unless a function
+		// still refers to it. Nothing more runs after the first error.
+		void run_streamed(source const& input)
 		{
+			static constexpr std::size_t PIPELINE_DEPTH = 16;
+
+			struct parsed_declaration
+			{
+				compilation_unit_ptr unit;
+				std::string diagnostics;
+				bool scan_error;
+				bool parse_error;
+				bool resolve_error;
+			};
+
 			had_error_ = had_parse_error_ = had_runtime_error_ = false;
 
-			auto [had_error, tokens] = scan_source(input);
-			if (had_error)
+			channel<parsed_declaration> parsed{PIPELINE_DEPTH};
+			std::exception_ptr producer_error;
+
+			std::jthread producer{[&]
 			{
-				stderr() << "error tokenizing input." << std::endl;
-				return;
+				try
+				{
+					// buffered so the consumer reports it in order with the output
+					std::ostringstream diagnostics;
+					token_stream tokens{input, diagnostics};
+					lox::parser parser{tokens, &diagnostics};
+					resolver res{diagnostics, interpreter_};
+
+					for (;;)
+					{
+						auto [had_parse_error, unit] = parser.parse_next();
+						if (!unit)
+							break;
+
+						if (!tokens.had_error() && !had_parse_error)
+						{
+							res.resolve(unit->statements());
+							if (!res.had_error())
+								optimizer{*unit}.optimize();
+						}
+
+						parsed_declaration decl{std::move(unit), diagnostics.str(), tokens.had_error(), had_parse_error, res.had_error()};
+						diagnostics.str({});
+						if (!parsed.push(std::move(decl)))
+							break;
+					}
+				}
+				catch (...)
+				{
+					producer_error = std::current_exception();
+				}
+				parsed.close();
+			}};
+
+			try
+			{
+				while (auto decl = parsed.pop())
+				{
+					stderr() << decl->diagnostics;
+					if (decl->scan_error && !had_error_)
+						stderr() << "error tokenizing input." << std::endl;
+
+					had_error_ = decl->scan_error;
+					had_parse_error_ = decl->parse_error;
+					if (had_error_ || had_parse_error_ || decl->resolve_error)
+						continue; // keep reporting errors, but run nothing more
+
+					if (!execute(*decl->unit))
+					{
+						parsed.close();
+						break;
+					}
+				}
+			}
+			catch (...)
+			{
+				parsed.close();
+				throw;
 			}
 
-			lox::parser parser{std::move(tokens)};
-			auto [had_parse_error, statements] = parser.parse();
-			had_error_ = had_error;
-			had_parse_error_ = had_parse_error_;
+			producer.join();
+			if (producer_error)
+				std::rethrow_exception(producer_error);
+		}
 
-			if (had_parse_error)
-				return;
+		// Runs `input` on the flat evaluator, loading the resolved tree from
+		// `cache_path` when it was written for the same contents by this
+		// version, and writing it there otherwise. A cache hit skips the
+		// scanner, parser and resolver.
+		void run_cached(source const& input, std::filesystem::path const& cache_path)
+		{
+			run_cached(input, cache_path, flat::cache_key::of(input));
+		}
 
-			resolver res{stderr(), interpreter_};
-			res.resolve(statements);
+		void run_cached(source const& input, std::filesystem::path const& cache_path, flat::cache_key key)
+		{
+			had_error_ = had_parse_error_ = had_runtime_error_ = false;
 
-			if (res.had_error())
-				return;
+			auto tree{flat::ast_file::load(cache_path, key, input)};
+			if (!tree)
+			{
+				token_stream tokens{input, stderr()};
+				lox::parser parser{tokens, &stderr()};
+				auto [had_parse_error, unit] = parser.parse();
+				had_error_ = tokens.had_error();
+				had_parse_error_ = had_parse_error;
+
+				if (had_error_)
+				{
+					stderr() << "error tokenizing input." << std::endl;
+					return;
+				}
+
+				if (had_parse_error)
+					return;
+
+				// resolve before folding, or errors in dead branches vanish
+				resolver tree_res{stderr(), interpreter_};
+				tree_res.resolve(unit->statements());
+				if (tree_res.had_error())
+					return;
+
+				optimizer{*unit}.optimize();
+				tree = flat::ast::flatten(*unit);
+				flat::resolver res{stderr()};
+				res.resolve(*tree);
+				if (res.had_error())
+					return;
+
+				// a cache that can't be written only costs the next run time
+				(void)flat::ast_file::save(*tree, key, cache_path);
+			}
 
 			try
 			{
-				interpreter_.interpret(statements);
+				flat::evaluator{interpreter_, *tree}.run();
 			}
 			catch(runtime_error const& ex)
 			{
@@ -81,15 +245,88 @@ namespace lox {
 				stderr() << ex.what() << std::endl;
 			}
 		}
-	
+
 	private:
 		std::istream* stdin_;
 		std::ostream* stdout_;
 		std::ostream* stderr_;
 		interpreter interpreter_;
+		vm::machine machine_;
+		lox::engine engine_ = engine::tree_walker;
 		bool had_error_ = false;
 		bool had_parse_error_ = false;
 		bool had_runtime_error_ = false;
+
+		void run(source const& input, std::shared_ptr<source const> owner)
+		{
+			had_error_ = had_parse_error_ = had_runtime_error_ = false;
+
+			// scanning is interleaved with parsing
+			token_stream tokens{input, stderr()};
+			lox::parser parser{tokens, &stderr()};
+			auto [had_parse_error, unit] = parser.parse();
+			unit->owned_source(owner); // owner outlives the scanner and parser
+			had_error_ = tokens.had_error();
+			had_parse_error_ = had_parse_error_;
+
+			if (had_error_)
+			{
+				stderr() << "error tokenizing input." << std::endl;
+				return;
+			}
+
+			if (had_parse_error)
+				return;
+
+			auto const& statements{unit->statements()};
+
+			resolver res{stderr(), interpreter_};
+			res.resolve(statements);
+
+			if (res.had_error())
+				return;
+
+			optimizer{*unit}.optimize();
+			execute(*unit);
+		}
+
+		// false if the unit failed to compile or raised a runtime error
+		bool execute(compilation_unit const& unit)
+		{
+			auto const& statements{unit.statements()};
+			try
+			{
+				if (engine_ == engine::flat)
+				{
+					auto tree{flat::ast::flatten(unit)};
+					flat::resolver res{stderr()};
+					res.resolve(*tree);
+					if (res.had_error())
+						return false;
+
+					flat::evaluator{interpreter_, *tree}.run();
+				}
+				else if (engine_ == engine::vm)
+				{
+					vm::compiler compiler{stderr()};
+					auto script{compiler.compile(statements)};
+					if (compiler.had_error())
+						return false;
+
+					machine_.interpret(std::move(script));
+				}
+				else
+					interpreter_.interpret(statements);
+			}
+			catch(runtime_error const& ex)
+			{
+				had_runtime_error_ = true;
+				stderr() << ex.what() << std::endl;
+				return false;
+			}
+
+			return true;
+		}
 	};
 
 } // namespace lox
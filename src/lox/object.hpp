@@ -1,42 +1,47 @@
 #pragma once
 
+#include <bit>
+#include <cassert>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
-#include <variant>
+#include <string>
+#include <string_view>
+#include <typeinfo>
 #include <fmt/format.h>
 
 #include "callable.hpp"
 #include "exceptions.hpp"
+#include "heap.hpp"
 #include "utility.hpp"
 
 namespace lox
 {
 	using std::nullptr_t;
 
+	// A Lox value, NaN-boxed into 64 bits. Doubles are stored as themselves;
+	// nil, booleans and pointers to heap objects live in the payload of a
+	// quiet NaN that arithmetic never produces (NaN results are canonicalized
+	// on the way in, keeping their sign).
+	//
+	//   double:  any bit pattern without all of QNAN set
+	//   nil:     QNAN | 1
+	//   false:   QNAN | 2
+	//   true:    QNAN | 3
+	//   heap:    SIGN | QNAN | 48-bit pointer to a heap_object
 	class object
 	{
-		template<typename T>
-		struct accessor
-		{
-			T operator()(auto&& arg) const
-			{
-				using ActualT = std::decay_t<decltype(arg)>;
+		static constexpr std::uint64_t SIGN_BIT = 0x8000000000000000;
+		static constexpr std::uint64_t QNAN = 0x7ffc000000000000;
+		static constexpr std::uint64_t HEAP_TAG = SIGN_BIT | QNAN;
 
-				if constexpr (std::is_same_v<ActualT, T>)
-					return arg;
-
-				auto msg{
-					fmt::format(
-						"Cannot get {}. Actual type: {}.",
-						typeid(T).name(), 
-						typeid(ActualT).name()
-					)
-				};
-				throw type_error{std::move(msg)};
-			}
-		};
+		static constexpr std::uint64_t NIL_BITS = QNAN | 1;
+		static constexpr std::uint64_t FALSE_BITS = QNAN | 2;
+		static constexpr std::uint64_t TRUE_BITS = QNAN | 3;
 
 	public:
 
@@ -49,54 +54,88 @@ namespace lox
 			CALLABLE
 		};
 
-		using holder_t = std::variant<
-			nullptr_t,
-			bool,
-			double,
-			std::string,
-			callable
-		>;
-
 		object()
-		: value_{nullptr}
+		: bits_{NIL_BITS}
 		{ }
 
 		object(object const& copy)
-		: value_{copy.value_}
+		: bits_{copy.bits_}
+		{
+			if (auto p = copy.heap())
+				p->add_ref();
+		}
+
+		object(object&& from) noexcept
+		: bits_{std::exchange(from.bits_, NIL_BITS)}
 		{ }
 
-		object(object&& from)
-		: value_{std::move(from.value_)}
+		explicit object(nullptr_t)
+		: bits_{NIL_BITS}
 		{ }
 
-		template<typename T>
-		explicit object(T&& value)
-		: value_{std::forward<T>(value)}
+		explicit object(bool value)
+		: bits_{value ? TRUE_BITS : FALSE_BITS}
+		{ }
+
+		explicit object(double value)
+		: bits_{std::bit_cast<std::uint64_t>(std::isnan(value) ? std::copysign(std::numeric_limits<double>::quiet_NaN(), value) : value)}
 		{ }
 
 		explicit object(int value)
-		: value_{static_cast<double>(value)}
+		: object{static_cast<double>(value)}
+		{ }
+
+		explicit object(const char* value)
+		: object{std::string{value}}
 		{ }
 
 		explicit object(std::string_view value)
-		: value_{std::string{value}}
+		: object{std::string{value}}
+		{ }
+
+		explicit object(std::string value)
+		: object{static_cast<heap_object const*>(make_ref<string_object>(std::move(value)).get())}
+		{ }
+
+		explicit object(callable const& value)
+		: object{static_cast<heap_object const*>(value.ptr().get())}
 		{ }
 
+		~object()
+		{
+			if (auto p = heap())
+				p->release();
+		}
+
 		object& operator=(object const& copy)
 		{
-			if (this != &copy)
-				value_ = copy.value_;
+			object tmp{copy};
+			std::swap(bits_, tmp.bits_);
 			return *this;
 		}
 
-		object& operator=(object&& from)
+		object& operator=(object&& from) noexcept
 		{
-			if (this != &from)
-				value_ = std::move(from.value_);
+			std::swap(bits_, from.bits_);
 			return *this;
 		}
 
-		type get_type() const { return static_cast<type>(value_.index()); }
+		type get_type() const
+		{
+			if (is_double())
+				return type::DOUBLE;
+
+			switch (bits_)
+			{
+				case NIL_BITS: return type::NIL;
+				case FALSE_BITS:
+				case TRUE_BITS: return type::BOOL;
+				default: break;
+			}
+
+			assert(heap());
+			return heap()->get_kind() == heap_object::kind::STRING ? type::STRING : type::CALLABLE;
+		}
 
 		const char* get_type_str() const
 		{
@@ -106,6 +145,7 @@ namespace lox
 				case type::DOUBLE: return "double";
 				case type::BOOL: return "bool";
 				case type::NIL: return "nil";
+				case type::CALLABLE: return "callable";
 
 				default:
 					throw programming_error{
@@ -117,17 +157,41 @@ namespace lox
 			}
 		}
 
+		bool is_double() const { return (bits_ & QNAN) != QNAN; }
+		bool is_nil() const { return bits_ == NIL_BITS; }
+		bool is_bool() const { return bits_ == TRUE_BITS || bits_ == FALSE_BITS; }
+
+		// The number held, without the check get<double>() makes; only for
+		// callers that have just tested is_double().
+		double as_number() const
+		{
+			assert(is_double());
+			return as_double();
+		}
+
+		// nullptr unless the object holds a value of that kind
+		string_object const* as_string() const
+		{
+			auto p{heap()};
+			return p && p->get_kind() == heap_object::kind::STRING ? static_cast<string_object const*>(p) : nullptr;
+		}
+
+		callable::impl const* as_callable() const
+		{
+			auto p{heap()};
+			return p && p->get_kind() == heap_object::kind::CALLABLE ? static_cast<callable::impl const*>(p) : nullptr;
+		}
+
 		std::string str() const
 		{
-			auto visitor = [](auto&& arg) -> std::string
+			switch (get_type())
 			{
-				using T = std::decay_t<decltype(arg)>;
+				case type::STRING:
+					return as_string()->value();
 
-				if constexpr (std::is_same_v<T, std::string>)
-					return arg;
-				else if constexpr (std::is_same_v<T, double>)
+				case type::DOUBLE:
 				{
-					auto s{std::to_string(arg)};
+					auto s{std::to_string(as_double())};
 					assert(!s.empty());
 
 					// trim trailing zeros in the decimal
@@ -149,43 +213,77 @@ namespace lox
 					}
 					return s;
 				}
-				else if constexpr (std::is_same_v<T, bool>)
-					return arg ? "true" : "false";
-				else if constexpr (std::is_same_v<T, nullptr_t>)
+
+				case type::BOOL:
+					return bits_ == TRUE_BITS ? "true" : "false";
+
+				case type::NIL:
 					return "nil";
-				else if constexpr (std::is_same_v<T, callable>)
-					return arg.str();
-				else 
-					static_assert(always_false_v<T>, "str: invalid visitor");
-			};
-			return std::visit(visitor, value_);
+
+				case type::CALLABLE:
+					return as_callable()->str();
+			}
+
+			LOX_THROW(programming_error, "str: invalid object");
 		}
 
 		template<typename T>
-		T get() const { return std::visit(accessor<T>(), value_); }
-
-		explicit operator bool() const
+		T get() const
 		{
-			auto visitor = [](auto&& arg)
+			if constexpr (std::is_same_v<T, double>)
 			{
-				using T = std::decay_t<decltype(arg)>;
-				if constexpr (std::is_same_v<T, bool>)
-					return arg;
-				if constexpr (std::is_same_v<T, nullptr_t>)
-					return false;
-				return true;
+				if (is_double())
+					return as_double();
+			}
+			else if constexpr (std::is_same_v<T, bool>)
+			{
+				if (is_bool())
+					return bits_ == TRUE_BITS;
+			}
+			else if constexpr (std::is_same_v<T, nullptr_t>)
+			{
+				if (is_nil())
+					return nullptr;
+			}
+			else if constexpr (std::is_same_v<T, std::string>)
+			{
+				if (auto s = as_string())
+					return s->value();
+			}
+			else if constexpr (std::is_same_v<T, callable>)
+			{
+				if (auto c = as_callable())
+					return callable{ref_ptr<const callable::impl>{c}};
+			}
+			else
+				static_assert(always_false_v<T>, "get: unsupported type");
+
+			auto msg{
+				fmt::format(
+					"Cannot get {}. Actual type: {}.",
+					typeid(T).name(),
+					get_type_str()
+				)
 			};
-			return std::visit(visitor, value_);
+			throw type_error{std::move(msg)};
+		}
+
+		explicit operator bool() const
+		{
+			return bits_ != FALSE_BITS && bits_ != NIL_BITS;
 		}
 
+		// Reports the referenced heap object, if any, to the collector.
+		void trace(tracer& t) const { t(heap()); }
+
 		explicit operator std::string() const { return get<std::string>(); }
 		explicit operator double() const {return get<double>(); }
 		explicit operator nullptr_t() const { return get<nullptr_t>(); }
 
 		object operator-() const
 		{
-			if (get_type() == type::DOUBLE)
-				return object{-static_cast<double>(*this)};
+			if (is_double())
+				return object{-as_double()};
 
 			auto msg {fmt::format("cannot apply unary '-' to type {}.", get_type_str())};
 			throw type_error{std::move(msg)};
@@ -196,27 +294,15 @@ namespace lox
 
 		bool operator==(object const& other) const
 		{
-			if (get_type() != other.get_type())
-				return false;
+			if (is_double() && other.is_double())
+				return as_double() == other.as_double();
 
-			auto visitor = [&other](auto&& arg)
-			{
-				using T = std::decay_t<decltype(arg)>;
-
-				if constexpr (std::is_same_v<T, std::string>)
-					return arg == std::get<std::string>(other.value_);
-				else if constexpr (std::is_same_v<T, double>)
-					return arg == std::get<double>(other.value_);
-				else if constexpr (std::is_same_v<T, bool>)
-					return arg == std::get<bool>(other.value_);
-				else if constexpr (std::is_same_v<T, nullptr_t>)
-					return true;
-				else if constexpr (std::is_same_v<T, callable>)
-					return &arg.cimpl() == &std::get<callable>(other.value_).cimpl();
-				else
-					static_assert(always_false_v<T>, "operator==: invalid visitor");
-			};
-			return std::visit(visitor, value_);
+			if (bits_ == other.bits_)
+				return true;
+
+			auto lhs{as_string()};
+			auto rhs{other.as_string()};
+			return lhs && rhs && lhs->value() == rhs->value();
 		}
 
 		bool operator!=(object const& other) const { return !(*this == other); }
@@ -226,58 +312,53 @@ namespace lox
 		bool operator>(object const& other) const { return numeric_op(other, ">", std::greater{}); }
 		bool operator>=(object const& other) const { return numeric_op(other, ">=", std::greater_equal{}); }
 
-		object operator+(object const& other) const
-		{
-			if (get_type() != other.get_type())
-				goto on_type_error;
-
-			switch (get_type())
-			{
-				case type::STRING:
-				case type::DOUBLE:
-					return object{std::plus<>{}(static_cast<double>(*this), static_cast<double>(other))};
-
-				default:
-					break;
-			}
-
-		on_type_error:
-			throw type_error{
-				fmt::format(
-					"unsupported operand type(s) for '+': '{}' and '{}'", 
-					get_type_str(), 
-					other.get_type_str()
-				)
-			};
-		}
+		object operator+(object const& other) const { return object{numeric_op(other, "+", std::plus{})}; }
 		object operator-(object const& other) const { return object{numeric_op(other, "-", std::minus{})}; }
 		object operator/(object const& other) const { return object{numeric_op(other, "/", std::divides{})}; }
 		object operator*(object const& other) const { return object{numeric_op(other, "*", std::multiplies{})}; }
 
 	private:
-		holder_t value_;
+		std::uint64_t bits_;
+
+		explicit object(heap_object const* ptr)
+		: bits_{HEAP_TAG | reinterpret_cast<std::uintptr_t>(ptr)}
+		{
+			assert(ptr);
+			assert((reinterpret_cast<std::uintptr_t>(ptr) & HEAP_TAG) == 0);
+			ptr->add_ref();
+		}
+
+		double as_double() const { return std::bit_cast<double>(bits_); }
+
+		heap_object const* heap() const
+		{
+			if ((bits_ & HEAP_TAG) != HEAP_TAG)
+				return nullptr;
+			return reinterpret_cast<heap_object const*>(bits_ & ~HEAP_TAG);
+		}
 
 		template<typename Op>
 		auto numeric_op(object const& other, const char* op_token, Op op) const -> decltype(op(0.0, 0.0))
 		{
-			if (get_type() != type::DOUBLE || get_type() != other.get_type())
+			if (!is_double() || !other.is_double())
 			{
 				throw type_error{
 					fmt::format(
-						"unsupported operand type(s) for '{}': '{}' and '{}'", 
-						op_token, 
-						get_type_str(), 
+						"unsupported operand type(s) for '{}': '{}' and '{}'",
+						op_token,
+						get_type_str(),
 						other.get_type_str()
 					)
 				};
 			}
 
-			return op(static_cast<double>(*this), static_cast<double>(other));
+			return op(as_double(), other.as_double());
 		}
 	};
 
+	static_assert(sizeof(object) == sizeof(std::uint64_t));
+
 	inline std::ostream& operator<<(std::ostream& os, object const& obj)
 	{ return os << obj.str(); }
 
 } // namespace lox
-
@@ -0,0 +1,416 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "compilation_unit.hpp"
+#include "expr.hpp"
+#include "object.hpp"
+#include "statement.hpp"
+
+namespace lox {
+
+	// Rewrites a resolved compilation unit so less of it is evaluated at run
+	// time. Constant subtrees become literals, groupings are dropped, and a
+	// few identities are simplified where the operand's type makes them
+	// exact. Nothing is folded that could raise an error: `-"a"` or `1 + nil`
+	// are left for the interpreter to report when they run.
+	//
+	// Folding never adds or removes a declaration, so the slots the resolver
+	// assigned stay valid.
+	class optimizer : statement::visitor
+	{
+	public:
+		explicit optimizer(compilation_unit& unit)
+		: unit_{&unit}
+		{ }
+
+		void optimize()
+		{
+			optimize(unit_->statements());
+		}
+
+		void optimize(std::vector<statement_ptr>& statements)
+		{
+			for (auto& stmt : statements)
+				optimize(stmt);
+
+			// what's left of `if (false) ...` and `while (false) ...`
+			std::erase_if(statements, [](statement_ptr const& stmt) { return is_empty_block(*stmt); });
+		}
+
+	private:
+		compilation_unit* unit_;
+		statement_ptr* current_ = nullptr;
+
+		// The tree is built non-const in the unit's arena; the visitors only
+		// hand it out as const.
+		template<class T>
+		static T& edit(T const& node) { return const_cast<T&>(node); }
+
+		static bool is_empty_block(statement const& stmt)
+		{
+			auto block{dynamic_cast<block_stmt const*>(&stmt)};
+			return block && block->statements().empty();
+		}
+
+		static literal const* as_literal(expression const& expr)
+		{
+			return expr.type() == expression::LITERAL ? static_cast<literal const*>(&expr) : nullptr;
+		}
+
+		static bool is_number(object const* value, double n)
+		{
+			return value && value->is_double() && static_cast<double>(*value) == n;
+		}
+
+		// Whether evaluating `expr` can only produce a number (or raise).
+		static bool yields_number(expression const& expr)
+		{
+			switch (expr.type())
+			{
+				case expression::LITERAL:
+					return static_cast<literal const&>(expr).value().is_double();
+
+				case expression::UNARY:
+					return static_cast<unary const&>(expr).op() == unary_op::NEGATE;
+
+				case expression::BINARY:
+					switch (static_cast<binary const&>(expr).op())
+					{
+						case binary_op::ADD:
+						case binary_op::SUBTRACT:
+						case binary_op::MULTIPLY:
+						case binary_op::DIVIDE:
+							return true;
+						default:
+							return false;
+					}
+
+				default:
+					return false;
+			}
+		}
+
+		// Whether evaluating `expr` can only produce a bool (or raise).
+		static bool yields_bool(expression const& expr)
+		{
+			switch (expr.type())
+			{
+				case expression::LITERAL:
+					return static_cast<literal const&>(expr).value().is_bool();
+
+				case expression::UNARY:
+					return static_cast<unary const&>(expr).op() == unary_op::NOT;
+
+				case expression::BINARY:
+					return !yields_number(expr);
+
+				default:
+					return false;
+			}
+		}
+
+		expression_ptr make_literal(object value)
+		{
+			return expression::make<literal>(unit_->memory(), std::move(value));
+		}
+
+		void optimize(statement_ptr& stmt)
+		{
+			auto enclosing{std::exchange(current_, &stmt)};
+			stmt->accept(*this);
+			current_ = enclosing;
+		}
+
+		void replace(statement_ptr&& with)
+		{
+			assert(current_);
+			*current_ = std::move(with);
+		}
+
+		// A block standing in for a statement that's gone. It runs in the
+		// environment the statement did, since that's what the resolver
+		// counted depths from.
+		statement_ptr replacement_block(block_stmt::statements_t statements = {}, bool has_scope = false)
+		{
+			auto block{statement::make<block_stmt>(unit_->memory(), std::move(statements))};
+			if (!has_scope)
+				static_cast<block_stmt const&>(*block).elide_scope();
+			return block;
+		}
+
+		// A condition is only tested for truthiness, so `!!x` can be `x`.
+		void optimize_condition(expression_ptr& expr)
+		{
+			optimize(expr);
+			while (expr->type() == expression::UNARY)
+			{
+				auto& outer{edit(static_cast<unary const&>(*expr))};
+				if (outer.op() != unary_op::NOT || outer.right().type() != expression::UNARY)
+					break;
+
+				auto& inner{edit(static_cast<unary const&>(outer.right()))};
+				if (inner.op() != unary_op::NOT)
+					break;
+
+				expr = std::move(inner.right_);
+			}
+		}
+
+		void optimize(expression_ptr& expr)
+		{
+			switch (expr->type())
+			{
+				case expression::GROUPING:
+				{
+					auto& group{edit(static_cast<grouping const&>(*expr))};
+					optimize(group.expr_);
+					expr = std::move(group.expr_);
+					break;
+				}
+
+				case expression::UNARY:
+					if (auto folded = fold(edit(static_cast<unary const&>(*expr))))
+						expr = std::move(folded);
+					break;
+
+				case expression::BINARY:
+					if (auto folded = fold(edit(static_cast<binary const&>(*expr))))
+						expr = std::move(folded);
+					break;
+
+				case expression::LOGICAL:
+					if (auto folded = fold(edit(static_cast<logical const&>(*expr))))
+						expr = std::move(folded);
+					break;
+
+				case expression::CALL:
+				{
+					auto& c{edit(static_cast<call const&>(*expr))};
+					optimize(c.callee_);
+					for (auto& arg : c.arguments_)
+						optimize(arg);
+					break;
+				}
+
+				case expression::ASSIGN:
+					optimize(edit(static_cast<assign const&>(*expr)).value_);
+					break;
+
+				case expression::LITERAL:
+				case expression::VARIABLE:
+					break;
+			}
+		}
+
+		// Each fold returns the replacement for its node, or null to keep it.
+		expression_ptr fold(unary& expr)
+		{
+			optimize(expr.right_);
+			auto const* right{as_literal(*expr.right_)};
+
+			switch (expr.op())
+			{
+				case unary_op::NOT:
+					if (right)
+						return make_literal(!right->value());
+
+					// `!!b` is `b` when b is already a bool
+					if (expr.right_->type() == expression::UNARY)
+					{
+						auto& inner{edit(static_cast<unary const&>(*expr.right_))};
+						if (inner.op() == unary_op::NOT && yields_bool(inner.right()))
+							return std::move(inner.right_);
+					}
+					break;
+
+				case unary_op::NEGATE:
+					if (right && right->value().is_double())
+						return make_literal(-right->value());
+
+					// `- -n` is `n` when n is already a number
+					if (expr.right_->type() == expression::UNARY)
+					{
+						auto& inner{edit(static_cast<unary const&>(*expr.right_))};
+						if (inner.op() == unary_op::NEGATE && yields_number(inner.right()))
+							return std::move(inner.right_);
+					}
+					break;
+
+				default:
+					break;
+			}
+
+			return {};
+		}
+
+		expression_ptr fold(binary& expr)
+		{
+			optimize(expr.left_);
+			optimize(expr.right_);
+
+			auto const* l{as_literal(*expr.left_)};
+			auto const* r{as_literal(*expr.right_)};
+			auto const* left{l ? &l->value() : nullptr};
+			auto const* right{r ? &r->value() : nullptr};
+
+			auto const op{expr.op()};
+			if (left && right)
+			{
+				// equality is defined for any pair; the rest only for numbers
+				if (op == binary_op::EQUAL)
+					return make_literal(object{*left == *right});
+				if (op == binary_op::NOT_EQUAL)
+					return make_literal(object{*left != *right});
+
+				if (left->is_double() && right->is_double())
+				{
+					switch (op)
+					{
+						case binary_op::SUBTRACT: return make_literal(*left - *right);
+						case binary_op::ADD: return make_literal(*left + *right);
+						case binary_op::DIVIDE: return make_literal(*left / *right);
+						case binary_op::MULTIPLY: return make_literal(*left * *right);
+						case binary_op::GREATER: return make_literal(object{*left > *right});
+						case binary_op::GREATER_EQUAL: return make_literal(object{*left >= *right});
+						case binary_op::LESS: return make_literal(object{*left < *right});
+						case binary_op::LESS_EQUAL: return make_literal(object{*left <= *right});
+						default: break;
+					}
+				}
+				return {};
+			}
+
+			// Identities that hold exactly for every number, including -0 and
+			// NaN; `n + 0` doesn't (-0 + 0 is 0), so it stays.
+			switch (op)
+			{
+				case binary_op::MULTIPLY:
+					if (is_number(right, 1) && yields_number(*expr.left_))
+						return std::move(expr.left_);
+					if (is_number(left, 1) && yields_number(*expr.right_))
+						return std::move(expr.right_);
+					break;
+
+				case binary_op::DIVIDE:
+					if (is_number(right, 1) && yields_number(*expr.left_))
+						return std::move(expr.left_);
+					break;
+
+				case binary_op::SUBTRACT:
+					if (is_number(right, 0) && !std::signbit(static_cast<double>(*right)) && yields_number(*expr.left_))
+						return std::move(expr.left_);
+					break;
+
+				default:
+					break;
+			}
+
+			return {};
+		}
+
+		expression_ptr fold(logical& expr)
+		{
+			optimize(expr.left_);
+			optimize(expr.right_);
+
+			auto const* left{as_literal(*expr.left_)};
+			if (!left)
+				return {};
+
+			// a literal left operand decides which side is the result
+			auto const truthy{static_cast<bool>(left->value())};
+			auto const short_circuits{expr.op() == logical_op::OR ? truthy : !truthy};
+			return std::move(short_circuits ? expr.left_ : expr.right_);
+		}
+
+		void visit(block_stmt const& stmt) override
+		{
+			optimize(edit(stmt).statements_);
+		}
+
+		void visit(expression_stmt const& stmt) override
+		{
+			optimize(edit(stmt).expr_);
+		}
+
+		void visit(for_stmt const& stmt) override
+		{
+			auto& s{edit(stmt)};
+			if (s.initializer_)
+				optimize(s.initializer_);
+			optimize_condition(s.condition_);
+			if (s.increment_)
+				optimize(s.increment_);
+			optimize(s.body_);
+
+			auto condition{as_literal(*s.condition_)};
+			if (condition && !static_cast<bool>(condition->value()))
+			{
+				// the initializer still runs, in a scope like the loop's
+				block_stmt::statements_t initializer;
+				if (s.initializer_)
+					initializer.push_back(std::move(s.initializer_));
+				replace(replacement_block(std::move(initializer), s.has_scope()));
+			}
+		}
+
+		void visit(func_stmt const& stmt) override
+		{
+			optimize(edit(stmt).body_);
+		}
+
+		void visit(if_stmt const& stmt) override
+		{
+			auto& s{edit(stmt)};
+			optimize_condition(s.condition_);
+			optimize(s.then_branch_);
+			if (s.else_branch_)
+				optimize(s.else_branch_);
+
+			if (auto condition = as_literal(*s.condition_))
+			{
+				if (static_cast<bool>(condition->value()))
+					replace(std::move(s.then_branch_));
+				else if (s.else_branch_)
+					replace(std::move(s.else_branch_));
+				else
+					replace(replacement_block());
+			}
+		}
+
+		void visit(print_stmt const& stmt) override
+		{
+			optimize(edit(stmt).expr_);
+		}
+
+		void visit(return_stmt const& stmt) override
+		{
+			auto& s{edit(stmt)};
+			if (s.value_)
+				optimize(s.value_);
+		}
+
+		void visit(var_stmt const& stmt) override
+		{
+			auto& s{edit(stmt)};
+			if (s.initializer_)
+				optimize(s.initializer_);
+		}
+
+		void visit(while_stmt const& stmt) override
+		{
+			auto& s{edit(stmt)};
+			optimize_condition(s.condition_);
+			optimize(s.body_);
+
+			auto condition{as_literal(*s.condition_)};
+			if (condition && !static_cast<bool>(condition->value()))
+				replace(replacement_block());
+		}
+	};
+
+} // namespace lox
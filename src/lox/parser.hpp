@@ -1,15 +1,17 @@
 #pragma once
 
 #include <source_location>
+#include <tuple>
+#include <utility>
 #include <vector>
+#include "compilation_unit.hpp"
 #include "exceptions.hpp"
 #include "statement.hpp"
 #include "token.hpp"
+#include "token_stream.hpp"
 
 namespace lox {
 
-using token_vec = std::vector<token>;
-
 class parser
 {
 	static constexpr const std::size_t MAX_ARGS = 255;
@@ -20,11 +22,10 @@ class parser
 
 public:
 
-	explicit parser(token_vec&& tokens, std::ostream* error = &std::cerr)
-	: tokens_{std::move(tokens)}
+	// Tokens are pulled from the stream as parsing proceeds.
+	explicit parser(token_stream& tokens, std::ostream* error = &std::cerr)
+	: tokens_{&tokens}
 	, error_(error)
-	, current_{0}
-	, end_{tokens_.size()}
 	, had_error_{false}
 	{ }
 
@@ -34,37 +35,50 @@ public:
 	parser& operator=(parser const&) = delete;
 	parser& operator=(parser&&) = default;
 
-	using statement_vec = std::vector<statement_ptr>;
+	using statement_vec = compilation_unit::statement_vec;
 
 	bool had_error() const { return had_error_; }
 
-	std::tuple<bool, statement_vec> parse()
+	// The returned unit owns the parsed statements.
+	std::tuple<bool, compilation_unit_ptr> parse()
 	{
-		statement_vec statements;
+		auto& statements{unit_->statements()};
 		
 		while (!is_at_end())
 		{
 			statements.push_back(declaration());
 		}
 
-		return std::make_tuple(had_error_, std::move(statements));
+		return std::make_tuple(had_error_, unit_);
+	}
+
+	// Parses only the next top-level declaration, into a unit of its own
+	// that can be freed once it has run. The unit is null at the end of
+	// input. Not to be mixed with parse().
+	std::tuple<bool, compilation_unit_ptr> parse_next()
+	{
+		if (is_at_end())
+			return std::make_tuple(had_error_, compilation_unit_ptr{});
+
+		unit_ = std::make_shared<compilation_unit>();
+		unit_->statements().push_back(declaration());
+		return std::make_tuple(had_error_, std::exchange(unit_, nullptr));
 	}
 
 
 private:
-	token_vec tokens_;
+	token_stream* tokens_;
 	std::ostream* error_;
-	std::size_t current_;
-	std::size_t end_;
 	bool had_error_;
+	compilation_unit_ptr unit_{std::make_shared<compilation_unit>()};
 
 	template<class T, class... Args>
-	static expression_ptr make_expr(Args&&... args)
-	{ return expression::make<T>(std::forward<Args>(args)...); }
+	expression_ptr make_expr(Args&&... args)
+	{ return expression::make<T>(unit_->memory(), std::forward<Args>(args)...); }
 
 	template<class T, class... Args>
-	static statement_ptr make_stmt(Args&&... args)
-	{ return statement::make<T>(std::forward<Args>(args)...); }
+	statement_ptr make_stmt(Args&&... args)
+	{ return statement::make<T>(unit_->memory(), std::forward<Args>(args)...); }
 
 	template<token_type... types>
 	bool match()
@@ -92,26 +106,18 @@ private:
 		return peek().type() == type;
 	}
 
-	token const& advance()
-	{
-		if (!is_at_end())
-			++current_;
+	token const& advance() { return tokens_->advance(); }
 
-		return previous();
-	}
-
-	bool is_at_end() const { return peek().type() == token_type::END_OF_FILE; }
-	token const& peek() const { return tokens_[current_]; }
-
-	token const& previous() const
-	{
-		assert(current_ != 0);
-		return tokens_[current_ - 1];
-	}
+	bool is_at_end() { return peek().type() == token_type::END_OF_FILE; }
+	token const& peek() { return tokens_->peek(); }
+	token const& previous() const { return tokens_->previous(); }
 
 	parse_error on_error(token const& tok, std::string_view message)
 	{
-		::lox::log_error(*error_, tok, message);
+		// after a scan error the tokens are incomplete, so further errors
+		// would only be its echo
+		if (!tokens_->had_error())
+			::lox::log_error(*error_, tok, message);
 		return parse_error{tok.type(), message};
 	}
 
@@ -162,6 +168,7 @@ private:
 		}
 		catch(parse_error const&)
 		{
+			had_error_ = true;
 			return expression_ptr{};
 		}
 	}
@@ -396,7 +403,7 @@ private:
 
 		auto body{block()};
 
-		return make_stmt<func_stmt>(std::move(name), std::move(parameters), std::move(body));
+		return make_stmt<func_stmt>(*unit_, std::move(name), std::move(parameters), std::move(body));
 	}
 
 	statement_ptr var_declaration()
@@ -470,25 +477,7 @@ private:
 
 		auto body{statement()};
 
-		if (increment)
-		{
-			statement_vec statements;
-			statements.push_back(std::move(body));
-			statements.push_back(make_stmt<expression_stmt>(std::move(increment)));
-			body = make_stmt<block_stmt>(std::move(statements));
-		}
-
-		body = make_stmt<while_stmt>(std::move(condition), std::move(body)); 
-
-		if (initializer)
-		{
-			statement_vec statements;
-			statements.push_back(std::move(initializer));
-			statements.push_back(std::move(body));
-			body = make_stmt<block_stmt>(std::move(statements));
-		}
-
-		return body;
+		return make_stmt<for_stmt>(std::move(initializer), std::move(condition), std::move(increment), std::move(body));
 	}
 
 	statement_ptr if_statement()
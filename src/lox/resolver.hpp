@@ -1,19 +1,89 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <functional>
+#include <limits>
 #include <ranges>
 #include <vector>
 #include <unordered_map>
 #include "exceptions.hpp"
 #include "interpreter.hpp"
+#include "symbol.hpp"
 
 namespace lox
 {
+	// Binds every local variable to where it lives. A local that no nested
+	// function refers to lives in its call's frame; the rest are captured
+	// and live in an environment, which a scope only gets if it declares
+	// one of them. Since that is only known once the whole scope has been
+	// seen, locals and the references to them are placed when it ends.
+	// Locals outside of any function always live in environments.
+	//
+	// It also infers what type each expression in a scope evaluates to.
+	// A local's type is what every value it's given has in common: its
+	// initializer and whatever is assigned to it, wherever that is, so a
+	// local keeps one type for its whole life. Parameters, functions and
+	// locals declared without a value are of unknown type, as are globals,
+	// which any later code may change. Binary nodes whose operands are
+	// proven numbers, or strings being compared, are marked so the
+	// interpreter can skip checking them.
 	class resolver : expression::visitor, statement::visitor
 	{
-		using scope_t = std::unordered_map<std::string, bool>;
+		struct binding
+		{
+			bool defined;
+			std::uint32_t declaration;
+		};
+
+		struct declaration
+		{
+			std::function<void(local_slot)> bind;
+			std::uint32_t scope;
+			std::uint32_t function;
+			std::uint32_t frame_slot;
+			std::uint32_t env_slot;
+			bool captured;
+
+			// what it's given; opaque if any of it has no inferred type
+			std::vector<expression const*> values = {};
+			bool opaque = false;
+		};
+
+		struct reference
+		{
+			expression const* expr;
+			std::uint32_t declaration;
+			std::uint32_t scope;
+		};
+
+		// what's kept of a scope after it ends, to count the environments
+		// between a reference and its declaration
+		struct scope_info
+		{
+			std::uint32_t parent;
+			bool has_env;
+		};
+
+		struct scope_t
+		{
+			std::unordered_map<symbol_id, binding> bindings;
+			std::vector<std::uint32_t> declarations;
+			std::vector<reference> references;
+			scoped_statement const* owner;
+			std::uint32_t id;
+			std::uint32_t frame_base;
+		};
+
 		using stack_t = std::vector<scope_t>;
 
+		static constexpr std::uint32_t no_scope = std::numeric_limits<std::uint32_t>::max();
+		static constexpr std::uint32_t no_declaration = std::numeric_limits<std::uint32_t>::max();
+
+		// nullopt until something is known, while solving for locals' types
+		using partial_type = std::optional<inferred_type>;
+
 		enum class function_type
 		{
 			NONE,
@@ -50,7 +120,7 @@ namespace lox
 		//
 		void visit(block_stmt const& stmt) override
 		{
-			begin_scope();
+			begin_scope(stmt);
 			resolve(stmt.statements());
 			end_scope();
 		}
@@ -60,9 +130,27 @@ namespace lox
 			resolve(stmt.expr());
 		}
 
+		void visit(for_stmt const& stmt) override
+		{
+			auto&& initializer{stmt.initializer()};
+			if (initializer)
+			{
+				begin_scope(stmt);
+				resolve(initializer->get());
+			}
+
+			resolve(stmt.condition());
+			if (auto&& increment = stmt.increment())
+				resolve(increment->get());
+			resolve(stmt.body());
+
+			if (initializer)
+				end_scope();
+		}
+
 		void visit(func_stmt const& stmt) override
 		{
-			declare(stmt.name());
+			opaque(declare(stmt.name(), [&stmt](local_slot slot) { stmt.resolve(slot); }));
 			define(stmt.name());
 			resolve_function(stmt, function_type::FUNCTION);
 		}
@@ -91,9 +179,15 @@ namespace lox
 
 		void visit(var_stmt const& stmt) override
 		{
-			declare(stmt.name());
+			auto decl{declare(stmt.name(), [&stmt](local_slot slot) { stmt.resolve(slot); })};
 			if (stmt.initializer())
+			{
 				resolve(*stmt.initializer());
+				if (decl != no_declaration)
+					declarations_[decl].values.push_back(stmt.initializer().get());
+			}
+			else
+				opaque(decl);
 			define(stmt.name());
 		}
 
@@ -111,12 +205,14 @@ namespace lox
 		{
 			resolve(expr.value());
 			resolve_local(expr, expr.name_token());
+			typed(expr);
 		}
 
 		void visit(binary const& expr) override
 		{
 			resolve(expr.left());
 			resolve(expr.right());
+			typed(expr);
 		}
 
 		void visit(call const& expr) override
@@ -129,6 +225,7 @@ namespace lox
 		void visit(grouping const& expr) override
 		{
 			resolve(expr.expr());
+			typed(expr);
 		}
 
 		void visit(literal const& expr) override
@@ -141,30 +238,40 @@ namespace lox
 		{
 			resolve(expr.left());
 			resolve(expr.right());
+			typed(expr);
 		}
 
 		void visit(unary const& expr) override
 		{
 			resolve(expr.right());
+			typed(expr);
 		}
 
 		void visit(variable const& expr) override
 		{
 			if (!scopes_.empty())
 			{
-				auto state{get(scopes_.back(), expr.name())};
-				if (state && *state == false)
+				auto state{get(scopes_.back().bindings, expr.symbol())};
+				if (state && !state->defined)
 					error(expr.name_token(), "Cannot read local variable in its own initializer.");
 			}
 
 			resolve_local(expr, expr.name_token());
+			typed(expr);
 		}
 
 	private:	
 		std::ostream* error_;
 		interpreter* inter_;
 		stack_t scopes_;
+		std::vector<declaration> declarations_;
+		std::vector<scope_info> closed_;
+		std::vector<expression const*> typed_;
+		std::unordered_map<expression const*, std::uint32_t> bound_;
 		function_type current_function_ = function_type::NONE;
+		std::uint32_t function_depth_ = 0;
+		std::uint32_t frame_next_ = 0;
+		std::uint32_t frame_size_ = 0;
 		bool had_error_ = false;
 	
 		template<typename K, typename V>
@@ -181,26 +288,100 @@ namespace lox
 			expr.accept(*this);
 		}
 
-		void begin_scope()
+		void begin_scope(scoped_statement const& owner)
 		{
-			scopes_.emplace_back();
+			auto id{static_cast<std::uint32_t>(closed_.size())};
+			closed_.push_back(scope_info{scopes_.empty() ? no_scope : scopes_.back().id, true});
+			scopes_.push_back(scope_t{{}, {}, {}, &owner, id, frame_next_});
 		}
 
 		void end_scope()
 		{
 			assert(!scopes_.empty());
+			auto& scope{scopes_.back()};
+
+			// captured locals get environment slots in the order they're
+			// defined at run time
+			std::uint32_t env_slots{0};
+			for (auto d : scope.declarations)
+			{
+				auto& decl{declarations_[d]};
+				if (decl.captured)
+				{
+					decl.env_slot = env_slots++;
+					decl.bind(local_slot{0, decl.env_slot});
+				}
+				else
+					decl.bind(local_slot{local_slot::frame, decl.frame_slot});
+			}
+
+			closed_[scope.id].has_env = env_slots > 0;
+			if (env_slots == 0)
+				scope.owner->elide_scope();
+
+			for (auto&& ref : scope.references)
+			{
+				auto const& decl{declarations_[ref.declaration]};
+				if (decl.captured)
+					inter_->resolve(*ref.expr, local_slot{environments_between(ref.scope, scope.id), decl.env_slot});
+				else
+					inter_->resolve(*ref.expr, local_slot{local_slot::frame, decl.frame_slot});
+			}
+
+			frame_next_ = scope.frame_base;
 			scopes_.pop_back();
+
+			// every reference has been placed, and every value a local is
+			// given has been seen
+			if (scopes_.empty())
+			{
+				infer_types();
+				declarations_.clear();
+				closed_.clear();
+				typed_.clear();
+				bound_.clear();
+			}
+		}
+
+		std::uint32_t environments_between(std::uint32_t from, std::uint32_t to) const
+		{
+			std::uint32_t depth{0};
+			for (auto id = from; id != to; id = closed_[id].parent)
+			{
+				assert(id != no_scope);
+				depth += closed_[id].has_env ? 1 : 0;
+			}
+			return depth;
 		}
 
-		void declare(token const& name)
+		// The declaration's index, or no_declaration for a global or a
+		// redeclaration.
+		std::uint32_t declare(token const& name, std::function<void(local_slot)> bind)
 		{
 			if (scopes_.empty())
-				return;
+				return no_declaration;
 
 			auto& scope = scopes_.back();
-			auto [_, inserted] = scope.insert(std::make_pair(std::string{name.lexeme()}, false));
+			auto index{static_cast<std::uint32_t>(declarations_.size())};
+			auto [_, inserted] = scope.bindings.insert(std::make_pair(name.symbol(), binding{false, index}));
 			if (!inserted)
+			{
 				error(name, "Already a variable with this name in this scope.");
+				return no_declaration;
+			}
+
+			// outside of functions there's no frame to put it in
+			declarations_.push_back(declaration{std::move(bind), scope.id, function_depth_, frame_next_, 0, function_depth_ == 0});
+			scope.declarations.push_back(index);
+			if (function_depth_ > 0)
+				frame_size_ = std::max(frame_size_, ++frame_next_);
+			return index;
+		}
+
+		void opaque(std::uint32_t decl)
+		{
+			if (decl != no_declaration)
+				declarations_[decl].opaque = true;
 		}
 
 		void define(token const& name)
@@ -209,7 +390,9 @@ namespace lox
 				return;
 
 			auto& scope = scopes_.back();
-			scope.insert_or_assign(std::string{name.lexeme()}, true);
+			auto i{scope.bindings.find(name.symbol())};
+			assert(i != scope.bindings.end());
+			i->second.defined = true;
 		}
 
 		void resolve_local(expression const& expr, token const& name)
@@ -217,9 +400,17 @@ namespace lox
 			for (size_t i = scopes_.size(); i > 0; --i)
 			{
 				auto&& scope = scopes_[i - 1];
-				if (scope.find(std::string{name.lexeme()}) != scope.end())
+				auto b{scope.bindings.find(name.symbol())};
+				if (b != scope.bindings.end())
 				{
-					inter_->resolve(expr, scopes_.size() - i);
+					auto& decl{declarations_[b->second.declaration]};
+					if (decl.function < function_depth_)
+						decl.captured = true;
+
+					scope.references.push_back(reference{&expr, b->second.declaration, scopes_.back().id});
+					bound_.emplace(&expr, b->second.declaration);
+					if (expr.type() == expression::ASSIGN)
+						decl.values.push_back(&static_cast<assign const&>(expr).value());
 					return;
 				}
 			}
@@ -228,32 +419,152 @@ namespace lox
 		void resolve_function(func_stmt const& stmt, function_type type)
 		{
 			auto enclosing_function{current_function_};
+			auto enclosing_next{frame_next_};
+			auto enclosing_size{frame_size_};
 			current_function_ = type;
+			++function_depth_;
+			frame_next_ = frame_size_ = 0;
 
-			begin_scope();
-			for (auto&& param : stmt.parameters())
+			begin_scope(stmt);
+			auto const& params{stmt.parameters()};
+			for (std::size_t i = 0; i < params.size(); ++i)
 			{
-				declare(param);
-				define(param);
+				opaque(declare(params[i], [&stmt, i](local_slot slot) { stmt.resolve_parameter(i, slot); }));
+				define(params[i]);
 			}
 			resolve(stmt.body());
 			end_scope();
+
+			stmt.frame_size(frame_size_);
+			frame_next_ = enclosing_next;
+			frame_size_ = enclosing_size;
+			--function_depth_;
 			current_function_ = enclosing_function;
 		}
 
+		// Expressions are only typed inside scopes; outside them every
+		// variable is a global.
+		void typed(expression const& expr)
+		{
+			if (!scopes_.empty())
+				typed_.push_back(&expr);
+		}
+
+		static partial_type join(partial_type a, partial_type b)
+		{
+			if (!a)
+				return b;
+			if (!b || a == b)
+				return a;
+			return inferred_type::UNKNOWN;
+		}
+
+		// The type `expr` evaluates to if it raises no error, given what's
+		// known so far of the locals' types.
+		partial_type type_of(expression const& expr, std::vector<partial_type> const& locals) const
+		{
+			switch (expr.type())
+			{
+				case expression::ASSIGN:
+					return type_of(static_cast<assign const&>(expr).value(), locals);
+
+				case expression::BINARY:
+					switch (static_cast<binary const&>(expr).op())
+					{
+						case binary_op::ADD:
+						case binary_op::SUBTRACT:
+						case binary_op::MULTIPLY:
+						case binary_op::DIVIDE:
+							return inferred_type::NUMBER;
+						default:
+							return inferred_type::BOOL;
+					}
+
+				case expression::GROUPING:
+					return type_of(static_cast<grouping const&>(expr).expr(), locals);
+
+				case expression::LOGICAL:
+				{
+					// the result is one of the operands
+					auto const& l{static_cast<logical const&>(expr)};
+					return join(type_of(l.left(), locals), type_of(l.right(), locals));
+				}
+
+				case expression::UNARY:
+					return static_cast<unary const&>(expr).op() == unary_op::NEGATE ? inferred_type::NUMBER : inferred_type::BOOL;
+
+				case expression::VARIABLE:
+				{
+					auto i{bound_.find(&expr)};
+					return i == bound_.end() ? inferred_type::UNKNOWN : locals[i->second];
+				}
+
+				case expression::LITERAL:
+					return expr.inferred();
+
+				case expression::CALL:
+					return inferred_type::UNKNOWN;
+			}
+			return inferred_type::UNKNOWN;
+		}
+
+		void infer_types()
+		{
+			// Each local starts with nothing known and takes in the types of
+			// the values it's given until none changes.
+			std::vector<partial_type> locals(declarations_.size());
+			for (std::size_t d = 0; d < declarations_.size(); ++d)
+			{
+				if (declarations_[d].opaque)
+					locals[d] = inferred_type::UNKNOWN;
+			}
+
+			for (bool changed = true; changed; )
+			{
+				changed = false;
+				for (std::size_t d = 0; d < declarations_.size(); ++d)
+				{
+					auto type{locals[d]};
+					for (auto value : declarations_[d].values)
+						type = join(type, type_of(*value, locals));
+
+					if (type != locals[d])
+					{
+						locals[d] = type;
+						changed = true;
+					}
+				}
+			}
+
+			for (auto expr : typed_)
+			{
+				expr->infer(type_of(*expr, locals).value_or(inferred_type::UNKNOWN));
+				if (expr->type() != expression::BINARY)
+					continue;
+
+				auto const& b{static_cast<binary const&>(*expr)};
+				auto const left{b.left().inferred()}, right{b.right().inferred()};
+				auto const equality{b.op() == binary_op::EQUAL || b.op() == binary_op::NOT_EQUAL};
+				if (left == inferred_type::NUMBER && right == inferred_type::NUMBER)
+					b.specialize(operand_profile::PROVEN_NUMBERS);
+				else if (equality && left == inferred_type::STRING && right == inferred_type::STRING)
+					b.specialize(operand_profile::PROVEN_STRINGS);
+			}
+		}
+
 		void error(token const& where, std::string_view message)
 		{
 #ifdef LOX_ENV_TRACE
 			for (auto&& scope : scopes_ | std::views::reverse)
 			{
 				*error_ << "scope @" << &scope << std::endl;
-				if (scope.empty())
+				if (scope.bindings.empty())
 					*error_ << "<empty>" << std::endl;
 				else
 				{
-					for (auto&& p : scope)
+					for (auto&& p : scope.bindings)
 					{
-						*error_ << '\t' << p.first << ": " << std::boolalpha << p.second << std::endl;
+						*error_ << '\t' << symbol_name(p.first) << ": " << std::boolalpha << p.second.defined << " @" << p.second.declaration << std::endl;
 					}
 				}
 			}
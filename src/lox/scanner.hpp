@@ -2,30 +2,21 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 #include <string_view>
 #include <tuple>
-#include <unordered_map>
 #include <vector>
 #include <fmt/format.h>
 
-#include <charconv>
-#include <system_error>
-
+#include "simd.hpp"
 #include "source_file.hpp"
 #include "token.hpp"
 #include "utility.hpp"
 
 namespace lox {
 
-	inline double double_from_chars(std::string_view sv)
-	{
-		double val;
-		auto [ptr, ec] {std::from_chars(std::begin(sv), std::end(sv), val) };
-		assert(ec == std::errc()); // should never happen (we've already assured the input), but sanity check
-		return val;
-	}
-
 	struct scanner_error_handler
 	{
 		scanner_error_handler(std::ostream& err = std::cerr)
@@ -63,6 +54,56 @@ namespace lox {
 	};
 
 
+	// Classifies an identifier lexeme. Switching on the leading characters
+	// narrows it to a single keyword candidate, which is compared whole, so
+	// ordinary identifiers are rejected without hashing.
+	constexpr token_type identifier_type(std::string_view id)
+	{
+		auto keyword = [id](std::string_view kw, token_type type)
+		{ return id == kw ? type : token_type::IDENTIFIER; };
+
+		if (id.size() < 2)
+			return token_type::IDENTIFIER;
+
+		switch (id[0])
+		{
+			case 'a': return keyword("and", token_type::AND);
+			case 'c': return keyword("class", token_type::CLASS);
+			case 'e': return keyword("else", token_type::ELSE);
+			case 'f':
+				switch (id[1])
+				{
+					case 'a': return keyword("false", token_type::FALSE_L);
+					case 'o': return keyword("for", token_type::FOR);
+					case 'u': return keyword("fun", token_type::FUN);
+				}
+				break;
+			case 'i': return keyword("if", token_type::IF);
+			case 'n': return keyword("nil", token_type::NIL);
+			case 'o': return keyword("or", token_type::OR);
+			case 'p': return keyword("print", token_type::PRINT);
+			case 'r': return keyword("return", token_type::RETURN);
+			case 's': return keyword("super", token_type::SUPER);
+			case 't':
+				switch (id[1])
+				{
+					case 'h': return keyword("this", token_type::THIS);
+					case 'r': return keyword("true", token_type::TRUE_L);
+				}
+				break;
+			case 'v': return keyword("var", token_type::VAR);
+			case 'w': return keyword("while", token_type::WHILE);
+		}
+
+		return token_type::IDENTIFIER;
+	}
+
+	static_assert(identifier_type("fun") == token_type::FUN);
+	static_assert(identifier_type("this") == token_type::THIS);
+	static_assert(identifier_type("thistle") == token_type::IDENTIFIER);
+	static_assert(identifier_type("f") == token_type::IDENTIFIER);
+
+
 	template<
 		typename TokenSink = token_handler,
 		typename ErrorHandler = scanner_error_handler
@@ -71,34 +112,8 @@ namespace lox {
 	{
 	public:
 
-		using keyword_map = std::unordered_map<std::string_view, token_type>;
-
-		static keyword_map const& keywords()
-		{
-			static const keyword_map keywords{
-				{"and", token_type::AND},
-				{"class", token_type::CLASS},
-				{"else", token_type::ELSE},
-				{"false", token_type::FALSE_L},
-				{"for", token_type::FOR},
-				{"fun", token_type::FUN},
-				{"if", token_type::IF},
-				{"nil", token_type::NIL},
-				{"or", token_type::OR},
-				{"print", token_type::PRINT},
-				{"return", token_type::RETURN},
-				{"super", token_type::SUPER},
-				{"this", token_type::THIS},
-				{"true", token_type::TRUE_L},
-				{"var", token_type::VAR},
-				{"while", token_type::WHILE},
-			};
-
-			return keywords;
-		}
-
 		explicit scanner(
-			source& source,
+			source const& source,
 			TokenSink&& token_sink = TokenSink(),
 			ErrorHandler&& error_handler = ErrorHandler()
 		)
@@ -108,38 +123,40 @@ namespace lox {
 		, current_{0}
 		, start_{0}
 		, end_{source.size()}
-		, line_{1}
 		, had_error_{false}
 		{ }
 
 		void scan();
 
+		// Scans until one more token has been handed to the sink. Returns
+		// false once the END_OF_FILE token has been produced.
+		bool step();
+
 		bool is_at_end() const { return current_ >= end_; }
 
 		bool had_error() const { return had_error_; }
 
 	private:
-		source& source_;
+		source const& source_;
 		TokenSink token_sink_;
 		ErrorHandler error_handler_;
 		std::size_t current_;
 		std::size_t start_;
 		std::size_t end_;
-		std::size_t line_;
 		bool had_error_;
+		bool started_ = false;
+		bool finished_ = false;
+		bool produced_ = false;
 
-		void add_token(token_type type)
+		void emit(token&& tok)
 		{
-			token_sink_(
-				token{type, std::string_view{source_.cbegin() + start_, current_ - start_}, location{source_, start_}}
-			);
+			produced_ = true;
+			token_sink_(std::move(tok));
 		}
 
-		void add_token(token_type type, object&& literal)
+		void add_token(token_type type)
 		{
-			token_sink_(
-				token{type, std::string_view{source_.cbegin() + start_, current_ - start_}, std::move(literal), location{source_, start_}}
-			);
+			emit(token{type, source_, start_, current_ - start_});
 		}
 
 		char advance()
@@ -188,43 +205,34 @@ namespace lox {
 				|| c == '_';
 		}
 
-		bool is_alpha_numeric(char c)
+		void seek(const char* pos)
 		{
-			return is_digit(c) || is_alpha(c);
+			current_ = static_cast<std::size_t>(pos - source_.cbegin());
 		}
 
-
-		void new_line()
+		void whitespace()
 		{
-			++line_;
-			source_.add_line(current_);
+			seek(simd::skip_whitespace(source_.cbegin() + current_, source_.cbegin() + end_));
 		}
 
 		void string()
 		{
-			while (peek() != '"' && !is_at_end())
-			{
-				if (peek() == '\n')
-					new_line();
-
-				advance();
-			}
+			seek(simd::find_quote(source_.cbegin() + current_, source_.cbegin() + end_));
 
 			if (is_at_end())
 			{
-				error("Unterminated string.");
+				// at the end of the string's last line rather than on the
+				// empty line after a final newline
+				auto at{current_};
+				if (at > start_ + 1 && source_[at - 1] == '\n')
+					--at;
+				error_at(at, "Unterminated string.");
 				return;
 			}
 
 			advance(); // closing quote
 
-			// Value without enclosing quotes
-			auto sv = source_.substr(
-				start_ + 1,
-				current_ - (start_ + 1) - 1
-			);
-
-			add_token(token_type::STRING, object{sv});
+			add_token(token_type::STRING);
 		}
 
 		void number()
@@ -239,31 +247,17 @@ namespace lox {
 					advance();
 			}
 
-			double val{double_from_chars(
-				source_.substr(
-					start_,
-					current_ - start_
-			))};
-			add_token(token_type::NUMBER, object{val});
+			add_token(token_type::NUMBER);
 		}
 
 		void identifier()
 		{
-			while (is_alpha_numeric(peek()))
-				advance();
+			seek(simd::skip_identifier(source_.cbegin() + current_, source_.cbegin() + end_));
 
-			auto&& kws = keywords();
-
-			auto id = current_lexeme();
-			auto i = kws.find(id);
-			auto type = i == kws.end() ? token_type::IDENTIFIER : i->second;
-
-			if (id == "true")
-				add_token(type, object{true});
-			else if (id == "false")
-				add_token(type, object{false});
-			else if (id == "nil")
-				add_token(type, object{});
+			auto id{current_lexeme()};
+			auto type{identifier_type(id)};
+			if (type == token_type::IDENTIFIER)
+				emit(token{type, source_, start_, current_ - start_, intern(id)});
 			else
 				add_token(type);
 		}
@@ -273,12 +267,8 @@ namespace lox {
 			char c{advance()};
 			switch(c)
 			{
-				case ' ': case '\t': case '\r':
-					// ignore whitespace
-					break;
-				
-				case '\n':
-					new_line();
+				case ' ': case '\t': case '\r': case '\n':
+					whitespace();
 					break;
 
 				case '(': add_token(token_type::LEFT_PAREN); break;
@@ -301,8 +291,7 @@ namespace lox {
 					if (match('/'))
 					{
 						// comment, ignore to end of line
-						while (peek() != '\n' && !is_at_end())
-							advance();
+						seek(simd::find_newline(source_.cbegin() + current_, source_.cbegin() + end_));
 					}
 					else
 						add_token(token_type::SLASH);
@@ -327,11 +316,16 @@ namespace lox {
 		}
 
 		void error(std::string_view message)
+		{
+			error_at(current_, message);
+		}
+
+		void error_at(std::size_t offset, std::string_view message)
 		{
 			had_error_ = true;
 			error_handler_(
 				source_,
-				current_,
+				offset,
 				"",
 				message
 			);
@@ -342,30 +336,53 @@ namespace lox {
 	template<typename TokenSink, typename ErrorHandler>
 	inline void scanner<TokenSink, ErrorHandler>::scan()
 	{
+		while (step())
+			;
+	}
+
+	template<typename TokenSink, typename ErrorHandler>
+	inline bool scanner<TokenSink, ErrorHandler>::step()
+	{
+		if (finished_)
+			return false;
+
+		if (!started_)
+		{
+			started_ = true;
+
+			// tokens address the source with 32-bit offsets
+			if (end_ > std::numeric_limits<std::uint32_t>::max())
+			{
+				error("Source is too large.");
+				current_ = end_ = 0;
+			}
+		}
+
+		produced_ = false;
 		while (!is_at_end())
 		{
 			start_ = current_;
 			scan_token();
+			if (produced_)
+				return true;
 		}
 
 		// force start_ to end_ so end of file lexeme is blank.
-		if (start_)
-			source_.add_line(start_);
-
-		source_.add_line(end_);
 		start_ = end_;
 		add_token(token_type::END_OF_FILE);
+		finished_ = true;
+		return true;
 	}
 
 
-	inline std::tuple<bool, std::vector<token>> scan_source(source& input)
+	inline std::tuple<bool, std::vector<token>> scan_source(source const& input)
 	{
 		std::vector<token> tokens;
 
 		auto handler = [&](token&& tok) { tokens.push_back(std::move(tok)); };
 		scanner<decltype(handler)> s{input, std::move(handler)};
 		s.scan();
-		return std::make_tuple(s.had_error(), tokens); 
+		return std::make_tuple(s.had_error(), std::move(tokens));
 	}
 
 
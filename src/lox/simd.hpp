@@ -0,0 +1,167 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Vectorized scanning of character runs for the scanner. Each routine
+// returns a pointer to the first character that ends the run (or `end`).
+// Runs are tested a register at a time with byte compares and movemask;
+// the tail and targets without SSE2 fall back to scalar loops. AVX2 is used
+// when the compiler targets it (e.g. EXTRA_CXXFLAGS=-mavx2).
+namespace lox::simd
+{
+	namespace detail
+	{
+		constexpr bool is_whitespace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+		constexpr bool is_identifier(char c)
+		{
+			return ('a' <= c && c <= 'z')
+				|| ('A' <= c && c <= 'Z')
+				|| ('0' <= c && c <= '9')
+				|| c == '_';
+		}
+
+#if defined(__AVX2__)
+		struct isa
+		{
+			using reg = __m256i;
+			static constexpr std::size_t width = 32;
+
+			static reg load(char const* p) { return _mm256_loadu_si256(reinterpret_cast<reg const*>(p)); }
+			static reg eq(reg v, char c) { return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)); }
+			static reg any(reg a, reg b) { return _mm256_or_si256(a, b); }
+			static std::uint32_t mask(reg v) { return static_cast<std::uint32_t>(_mm256_movemask_epi8(v)); }
+
+			// lo <= c <= hi, for ASCII bounds
+			static reg in_range(reg v, char lo, char hi)
+			{
+				return _mm256_and_si256(
+					_mm256_cmpgt_epi8(v, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+					_mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), v)
+				);
+			}
+		};
+#elif defined(__SSE2__)
+		struct isa
+		{
+			using reg = __m128i;
+			static constexpr std::size_t width = 16;
+
+			static reg load(char const* p) { return _mm_loadu_si128(reinterpret_cast<reg const*>(p)); }
+			static reg eq(reg v, char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+			static reg any(reg a, reg b) { return _mm_or_si128(a, b); }
+			static std::uint32_t mask(reg v) { return static_cast<std::uint32_t>(_mm_movemask_epi8(v)); }
+
+			// lo <= c <= hi, for ASCII bounds
+			static reg in_range(reg v, char lo, char hi)
+			{
+				return _mm_and_si128(
+					_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+					_mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(hi + 1)), v)
+				);
+			}
+		};
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+		constexpr std::uint32_t full_mask = isa::width == 32 ? 0xffffffffu : (1u << isa::width) - 1;
+#endif
+	}
+
+	// Skips spaces, tabs, carriage returns and newlines.
+	inline char const* skip_whitespace(char const* p, char const* end)
+	{
+#if defined(__AVX2__) || defined(__SSE2__)
+		using detail::isa;
+		for (; end - p >= static_cast<std::ptrdiff_t>(isa::width); p += isa::width)
+		{
+			auto v{isa::load(p)};
+			auto ws{isa::any(isa::any(isa::eq(v, ' '), isa::eq(v, '\t')), isa::any(isa::eq(v, '\r'), isa::eq(v, '\n')))};
+			if (auto stop = ~isa::mask(ws) & detail::full_mask)
+				return p + std::countr_zero(stop);
+		}
+#endif
+		while (p != end && detail::is_whitespace(*p))
+			++p;
+		return p;
+	}
+
+	// Finds the end of a line comment: the next '\n'.
+	inline char const* find_newline(char const* p, char const* end)
+	{
+#if defined(__AVX2__) || defined(__SSE2__)
+		using detail::isa;
+		for (; end - p >= static_cast<std::ptrdiff_t>(isa::width); p += isa::width)
+		{
+			if (auto stop = isa::mask(isa::eq(isa::load(p), '\n')))
+				return p + std::countr_zero(stop);
+		}
+#endif
+		while (p != end && *p != '\n')
+			++p;
+		return p;
+	}
+
+	// Finds the closing quote of a string body.
+	inline char const* find_quote(char const* p, char const* end)
+	{
+#if defined(__AVX2__) || defined(__SSE2__)
+		using detail::isa;
+		for (; end - p >= static_cast<std::ptrdiff_t>(isa::width); p += isa::width)
+		{
+			if (auto stop = isa::mask(isa::eq(isa::load(p), '"')))
+				return p + std::countr_zero(stop);
+		}
+#endif
+		while (p != end && *p != '"')
+			++p;
+		return p;
+	}
+
+	// Calls on_newline(ptr) for every '\n' in [p, end), in order.
+	template<class OnNewline>
+	void for_each_newline(char const* p, char const* end, OnNewline&& on_newline)
+	{
+#if defined(__AVX2__) || defined(__SSE2__)
+		using detail::isa;
+		for (; end - p >= static_cast<std::ptrdiff_t>(isa::width); p += isa::width)
+		{
+			for (auto newlines = isa::mask(isa::eq(isa::load(p), '\n')); newlines != 0; newlines &= newlines - 1)
+				on_newline(p + std::countr_zero(newlines));
+		}
+#endif
+		for (; p != end; ++p)
+		{
+			if (*p == '\n')
+				on_newline(p);
+		}
+	}
+
+	// Finds the end of an identifier tail: the first character that isn't
+	// a letter, digit or underscore.
+	inline char const* skip_identifier(char const* p, char const* end)
+	{
+#if defined(__AVX2__) || defined(__SSE2__)
+		using detail::isa;
+		for (; end - p >= static_cast<std::ptrdiff_t>(isa::width); p += isa::width)
+		{
+			auto v{isa::load(p)};
+			auto ident{isa::any(
+				isa::any(isa::in_range(v, 'a', 'z'), isa::in_range(v, 'A', 'Z')),
+				isa::any(isa::in_range(v, '0', '9'), isa::eq(v, '_'))
+			)};
+			if (auto stop = ~isa::mask(ident) & detail::full_mask)
+				return p + std::countr_zero(stop);
+		}
+#endif
+		while (p != end && detail::is_identifier(*p))
+			++p;
+		return p;
+	}
+
+} // namespace lox::simd
@@ -1,29 +1,110 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstdint>
+#include <istream>
 #include <iterator>
+#include <mutex>
 #include <string>
 #include <string_view>
+#include <vector>
 #include <boost/interprocess/file_mapping.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 #include <fmt/format.h>
 
 #include "exceptions.hpp"
+#include "simd.hpp"
 
 
 namespace lox {
 
+	class source;
+
+	// Maps the 16-bit ids that tokens carry back to their source. Ids are
+	// reused once a source is destroyed.
+	class source_registry
+	{
+	public:
+		using id_type = std::uint16_t;
+
+		static constexpr std::size_t MAX_SOURCES = std::size_t{1} << 16;
+
+		static source_registry& get()
+		{
+			static source_registry instance;
+			return instance;
+		}
+
+		source_registry(source_registry const&) = delete;
+		source_registry& operator=(source_registry const&) = delete;
+
+		id_type add(source const& s)
+		{
+			std::lock_guard lock{mutex_};
+
+			id_type id;
+			if (!free_.empty())
+			{
+				id = free_.back();
+				free_.pop_back();
+			}
+			else if (next_ < MAX_SOURCES)
+				id = static_cast<id_type>(next_++);
+			else
+				LOX_THROW(programming_error, "too many live sources");
+
+			sources_[id] = &s;
+			return id;
+		}
+
+		void remove(id_type id)
+		{
+			std::lock_guard lock{mutex_};
+			assert(sources_[id] != nullptr);
+			sources_[id] = nullptr;
+			free_.push_back(id);
+		}
+
+		// The source must outlive every token that refers to it.
+		source const& find(id_type id) const
+		{
+			assert(sources_[id] != nullptr);
+			return *sources_[id];
+		}
+
+	private:
+		std::mutex mutex_;
+		std::array<source const*, MAX_SOURCES> sources_{};
+		std::vector<id_type> free_;
+		std::size_t next_ = 0;
+
+		source_registry() = default;
+	};
+
 	// TODO: Handle UTF-8 byte-order-mark
 	class source
 	{
 	public:
-		virtual ~source() { }
+		using id_type = source_registry::id_type;
+
+		virtual ~source()
+		{
+			source_registry::get().remove(id_);
+		}
 
 		source()
-		: lines_(1, 0)
+		: id_{source_registry::get().add(*this)}
 		{ }
 
+		// registered by address, so sources stay put
+		source(source const&) = delete;
+		source& operator=(source const&) = delete;
+
+		id_type id() const { return id_; }
+		static source const& from_id(id_type id) { return source_registry::get().find(id); }
+
 		virtual std::string const& name() const = 0;
 
 		virtual std::string_view view() const = 0;
@@ -47,23 +128,13 @@ namespace lox {
 			return std::string_view{start, len};
 		}
 
-		void add_line(std::size_t offset)
-		{
-			assert(offset <= size());
-			lines_.push_back(offset);
-		}
-
 		// (line_number, line_offset, line)
 		std::tuple<std::size_t, std::size_t, std::string_view> get_line(std::size_t offset) const
 		{
 			assert(offset <= size());
-			auto i = std::lower_bound(std::cbegin(lines_), std::cend(lines_), offset);
-			if (*i >= offset)
-				--i;
 
 			const auto line_no_{line_no(offset)};
-			const auto line_off{line_no(offset) - 1};
-			const auto line_start{lines_[line_off]};
+			const auto line_start{lines_[line_no_ - 1]};
 			const auto line_end{std::find(cbegin() + line_start, cend(), '\n')};
 
 			return std::make_tuple(
@@ -73,26 +144,31 @@ namespace lox {
 			);
 		}
 
+		// 1-based; the end of the source belongs to the last line
 		std::size_t line_no(std::size_t offset) const
 		{
-			if (offset >= size())
-				return lines_.size() - 1;
+			assert(!lines_.empty()); // derived constructors must call index_lines()
+			auto i{std::upper_bound(std::cbegin(lines_), std::cend(lines_), offset)};
+			return static_cast<std::size_t>(i - std::cbegin(lines_));
+		}
 
-			// not the fastest, but do a linear search to find the line number containing offset
-			// this shouldn't be called often, so we're fine taking the performance hit
-			// for a clearer implementation.
-			for (size_t i = 0; i < lines_.size() - 1; ++i)
-			{
-				if (lines_[i] <= offset && offset < lines_[i + 1])
-					return i + 1;
-			}
+		std::size_t line_count() const { return lines_.size(); }
 
-			// should be unreachable, probably indicates we didn't build lines_ correctly.
-			LOX_THROW(programming_error, fmt::format("failed to find line number for offset: {}", offset));
+	protected:
+		// Records where each line starts. Called once the derived class can
+		// serve its contents.
+		void index_lines()
+		{
+			lines_.assign(1, 0);
+			simd::for_each_newline(cbegin(), cend(), [this](const char* nl)
+			{
+				lines_.push_back(static_cast<std::size_t>(nl + 1 - cbegin()));
+			});
 		}
 
 	private:
 		std::vector<std::size_t> lines_;
+		id_type id_;
 	};
 
 
@@ -105,16 +181,12 @@ namespace lox {
 		: file_path_{std::forward<FilePath>(file_path)}
 		, file_{file_path_.c_str(), boost::interprocess::read_only}
 		, region_{file_, boost::interprocess::read_only}
-		{ }
+		{
+			index_lines();
+		}
 
-		file_source(file_source&& other) = default;
-		file_source& operator=(file_source&&) = default;
-		
 		~file_source() = default;
 
-		file_source& operator=(file_source const&) = delete;
-		file_source(file_source const&) = delete;
-
 		std::string const& name() const override { return file_path_; }
 
 
@@ -147,7 +219,9 @@ namespace lox {
 		explicit string_source(NameType&& name, Contents&& contents)
 		: name_{std::forward<NameType>(name)}
 		, contents_{std::forward<Contents>(contents)}
-		{ }
+		{
+			index_lines();
+		}
 
 		std::string const& name() const override { return name_; }
 
@@ -162,6 +236,19 @@ namespace lox {
 		std::string contents_;
 	};
 
+	// Input that can't be mapped, such as a pipe or stdin, read to its end.
+	class stream_source : public string_source
+	{
+	public:
+		template<class NameType>
+		stream_source(NameType&& name, std::istream& input)
+		: string_source{
+			std::forward<NameType>(name),
+			std::string{std::istreambuf_iterator<char>{input}, std::istreambuf_iterator<char>{}}
+		}
+		{ }
+	};
+
 	class location
 	{
 	public:
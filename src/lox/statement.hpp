@@ -8,12 +8,15 @@
 
 namespace lox {
 
+	class compilation_unit;
+	class optimizer;
 	class statement;
-	using statement_ptr = std::unique_ptr<statement>;
+	using statement_ptr = arena_ptr<statement>;
 
 	// concrete statements
 	class block_stmt;
 	class expression_stmt;
+	class for_stmt;
 	class func_stmt;
 	class if_stmt;
 	class print_stmt;
@@ -31,6 +34,7 @@ namespace lox {
 
 			virtual void visit(block_stmt const& stmt) = 0;
 			virtual void visit(expression_stmt const& stmt) = 0;
+			virtual void visit(for_stmt const& stmt) = 0;
 			virtual void visit(func_stmt const& stmt) = 0;
 			virtual void visit(if_stmt const& smt) = 0;
 			virtual void visit(print_stmt const& stmt) = 0;
@@ -52,12 +56,26 @@ namespace lox {
 		virtual void accept(visitor& v) const = 0;
 
 		template<typename T, typename... Args>
-		static statement_ptr make(Args... args)
-		{ return std::make_unique<T>(std::forward<Args>(args)...); }
+		static statement_ptr make(arena& memory, Args&&... args)
+		{ return statement_ptr{memory.make<T>(std::forward<Args>(args)...)}; }
 	};
 
 
-	class block_stmt : public statement
+	// A statement that opens a scope. The resolver clears has_scope() when
+	// nothing declared in the scope is captured, so it can run in the
+	// enclosing environment.
+	class scoped_statement : public statement
+	{
+	public:
+		bool has_scope() const { return has_scope_; }
+		void elide_scope() const { has_scope_ = false; }
+
+	private:
+		mutable bool has_scope_ = true;
+	};
+
+
+	class block_stmt : public scoped_statement
 	{
 	public:
 		using statements_t = std::vector<statement_ptr>;
@@ -70,6 +88,8 @@ namespace lox {
 
 		void accept(visitor& v) const override { v.visit(*this); }
 
+		friend class optimizer;
+
 	private:
 		statements_t statements_;
 	};
@@ -86,58 +106,99 @@ namespace lox {
 
 		void accept(visitor& v) const override { v.visit(*this); }
 
+		friend class optimizer;
+
 	private:
 		expression_ptr expr_;
 	};
 
 
-	class func_stmt : public statement
+	// A `for` loop. The initializer, if any, is declared in a scope of the
+	// loop's own that lasts for all of its iterations.
+	class for_stmt : public scoped_statement
 	{
 	public:
-		using parameters_t = std::vector<token>;
-		using statements_t = std::vector<statement_ptr>;
-
-		struct impl
+		explicit for_stmt(statement_ptr&& initializer, expression_ptr&& condition, expression_ptr&& increment, statement_ptr&& body)
+		: initializer_{std::move(initializer)}
+		, condition_{std::move(condition)}
+		, increment_{std::move(increment)}
+		, body_{std::move(body)}
 		{
-			token name_;
-			parameters_t params_;
-			statements_t body_;
-		};
+			assert(condition_);
+			assert(body_);
+		}
 
-		explicit func_stmt(token&& name, parameters_t&& params, statements_t&& body)
-		:	impl_{std::make_shared<impl>(std::move(name), std::move(params), std::move(body))}
-		{ }
+		std::optional<std::reference_wrapper<const statement>> initializer() const
+		{ return initializer_ ? std::make_optional(std::cref(*initializer_)) : std::nullopt; }
 
-		func_stmt(func_stmt const& copy)
-		: impl_{copy.impl_}
-		{ }
+		expression const& condition() const { return *condition_; }
+
+		std::optional<std::reference_wrapper<const expression>> increment() const
+		{ return increment_ ? std::make_optional(std::cref(*increment_)) : std::nullopt; }
+
+		statement const& body() const { return *body_; }
+
+		void accept(visitor& v) const override { v.visit(*this); }
 
-		func_stmt(func_stmt&& from)
-		: impl_{std::move(from.impl_)}
+		friend class optimizer;
+
+	private:
+		statement_ptr initializer_;
+		expression_ptr condition_;
+		expression_ptr increment_;
+		statement_ptr body_;
+	};
+
+
+	class func_stmt : public scoped_statement
+	{
+	public:
+		using parameters_t = std::vector<token>;
+		using statements_t = std::vector<statement_ptr>;
+
+		explicit func_stmt(compilation_unit const& unit, token&& name, parameters_t&& params, statements_t&& body)
+		: unit_{&unit}
+		, name_{std::move(name)}
+		, params_{std::move(params)}
+		, body_{std::move(body)}
 		{ }
 
-		func_stmt& operator=(func_stmt const& copy)
-		{
-			if (this != &copy)
-				impl_ = copy.impl_;
-			return *this;
-		}
+		// the unit whose arena holds this function's body
+		compilation_unit const& unit() const { return *unit_; }
 
-		func_stmt& operator=(func_stmt&& from)
+		token const& name() const { return name_; }
+		parameters_t const& parameters() const { return params_; }
+		statements_t const& body() const { return body_; }
+
+		// Set by the resolver: where the name and each parameter live (see
+		// local_slot), and how many frame slots a call needs. Empty when
+		// they live in environments.
+		std::optional<local_slot> const& local() const { return local_; }
+		void resolve(local_slot slot) const { local_ = slot; }
+
+		std::optional<local_slot> parameter(std::size_t index) const
+		{ return index < param_locals_.size() ? std::make_optional(param_locals_[index]) : std::nullopt; }
+		void resolve_parameter(std::size_t index, local_slot slot) const
 		{
-			assert(this != &from);
-			impl_ = std::move(from.impl_);
-			return *this;
+			param_locals_.resize(params_.size(), local_slot{0, 0});
+			param_locals_[index] = slot;
 		}
 
-		token const& name() const { return impl_->name_; }
-		parameters_t const& parameters() const { return impl_->params_; }
-		statements_t const& body() const { return impl_->body_; }
+		std::uint32_t frame_size() const { return frame_size_; }
+		void frame_size(std::uint32_t size) const { frame_size_ = size; }
 
 		void accept(visitor& v) const override { v.visit(*this); }
 
+		friend class optimizer;
+
 	private:
-		std::shared_ptr<impl> impl_;
+		compilation_unit const* unit_;
+		token name_;
+		parameters_t params_;
+		statements_t body_;
+		mutable std::optional<local_slot> local_;
+		mutable std::vector<local_slot> param_locals_;
+		mutable std::uint32_t frame_size_ = 0;
 	};
 
 
@@ -161,6 +222,8 @@ namespace lox {
 
 		void accept(visitor& v) const override { v.visit(*this); }
 
+		friend class optimizer;
+
 	private:
 		expression_ptr condition_;
 		statement_ptr then_branch_;
@@ -179,6 +242,8 @@ namespace lox {
 
 		void accept(visitor& v) const override { v.visit(*this); }
 
+		friend class optimizer;
+
 	private:
 		expression_ptr expr_;
 	};
@@ -197,6 +262,8 @@ namespace lox {
 
 		void accept(visitor& v) const override { v.visit(*this); }
 
+		friend class optimizer;
+
 	private:
 		token keyword_;
 		expression_ptr value_;
@@ -213,11 +280,18 @@ namespace lox {
 		token const& name() const { return name_; }
 		expression_ptr const& initializer() const { return initializer_; }
 
+		// set by the resolver for a local: where it lives (see local_slot).
+		std::optional<local_slot> const& local() const { return local_; }
+		void resolve(local_slot slot) const { local_ = slot; }
+
 		void accept(visitor& v) const override { v.visit(*this); }
 
+		friend class optimizer;
+
 	private:
 		token name_;
 		expression_ptr initializer_;
+		mutable std::optional<local_slot> local_;
 	};
 	
 	class while_stmt : public statement
@@ -236,6 +310,8 @@ namespace lox {
 
 		void accept(visitor& v) const override { v.visit(*this); }
 
+		friend class optimizer;
+
 	private:
 		expression_ptr condition_;
 		statement_ptr body_;
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace lox
+{
+	// Dense id of an interned identifier. Equal names have equal ids, so
+	// names compare as integers once scanned.
+	using symbol_id = std::uint32_t;
+
+	inline constexpr symbol_id no_symbol = std::numeric_limits<symbol_id>::max();
+
+	// Process-wide intern table. Ids are handed out in order starting at 0
+	// and never reused, which lets tables keyed by symbol be plain vectors.
+	// Guarded by a mutex since sources may be scanned on another thread.
+	class symbol_table
+	{
+	public:
+		static symbol_table& get()
+		{
+			static symbol_table instance;
+			return instance;
+		}
+
+		symbol_table(symbol_table const&) = delete;
+		symbol_table& operator=(symbol_table const&) = delete;
+
+		symbol_id intern(std::string_view name)
+		{
+			std::lock_guard lock{mutex_};
+
+			auto i{ids_.find(name)};
+			if (i != ids_.end())
+				return i->second;
+
+			assert(names_.size() < no_symbol);
+			auto id{static_cast<symbol_id>(names_.size())};
+			auto const& stored{names_.emplace_back(name)};
+			ids_.emplace(std::string_view{stored}, id);
+			return id;
+		}
+
+		std::string_view name(symbol_id id) const
+		{
+			std::lock_guard lock{mutex_};
+			assert(id < names_.size());
+			return names_[id];
+		}
+
+		std::size_t size() const
+		{
+			std::lock_guard lock{mutex_};
+			return names_.size();
+		}
+
+	private:
+		mutable std::mutex mutex_;
+		std::deque<std::string> names_; // stable addresses for the keys below
+		std::unordered_map<std::string_view, symbol_id> ids_;
+
+		symbol_table() = default;
+	};
+
+	inline symbol_id intern(std::string_view name) { return symbol_table::get().intern(name); }
+	inline std::string_view symbol_name(symbol_id id) { return symbol_table::get().name(id); }
+
+} // namespace lox
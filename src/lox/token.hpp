@@ -1,14 +1,32 @@
 #pragma once
 
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <limits>
 #include <string_view>
+#include <system_error>
 #include <type_traits>
 #include <fmt/format.h>
 #include "object.hpp"
 #include "source_file.hpp"
+#include "symbol.hpp"
 #include "token_type.hpp"
 
 namespace lox {
 
+	inline double double_from_chars(std::string_view sv)
+	{
+		double val;
+		auto [ptr, ec] {std::from_chars(std::begin(sv), std::end(sv), val) };
+		assert(ec == std::errc()); // should never happen (we've already assured the input), but sanity check
+		return val;
+	}
+
+	// A token is a typed span of its source. The lexeme is read back from
+	// the source on demand and literal values are decoded from it when
+	// asked for, which keeps tokens small enough to scan big inputs into a
+	// cache-friendly vector. Identifiers also carry their interned symbol.
 	class token
 	{
 	public:
@@ -17,16 +35,16 @@ namespace lox {
 
 		token() = default;
 	
-		token(token_type type, std::string_view	lexeme, object&& literal, location const& loc)
-		: type_{type}
-		, lexeme_{lexeme}
-		, literal_{std::move(literal)}
-		, location_{loc}
-		{ }
-
-		token(token_type type, std::string_view lexeme, location const& loc)
-		: token(type, lexeme, object{}, loc)
-		{ }
+		token(token_type type, source const& where, std::size_t offset, std::size_t length, symbol_id symbol = no_symbol)
+		: offset_{static_cast<std::uint32_t>(offset)}
+		, length_{static_cast<std::uint32_t>(length)}
+		, symbol_{symbol}
+		, source_id_{where.id()}
+		, type_{type}
+		{
+			assert(offset <= std::numeric_limits<std::uint32_t>::max());
+			assert(length <= std::numeric_limits<std::uint32_t>::max());
+		}
 
 		token(token const&) = default;
 		token(token&&) = default;
@@ -35,19 +53,41 @@ namespace lox {
 		token& operator=(token&&) = default;
 
 		token_type type() const { return type_; }
-		std::string_view const& lexeme() const { return lexeme_; }
-		object const& literal() const { return literal_; }
-		location const& source_location() const { return location_; }
+		std::uint32_t offset() const { return offset_; }
+		std::uint32_t length() const { return length_; }
+		source::id_type source_id() const { return source_id_; }
+
+		// interned name of an identifier; no_symbol for other tokens
+		symbol_id symbol() const { return symbol_; }
+
+		source const& where() const { return source::from_id(source_id_); }
+		std::string_view lexeme() const { return std::string_view{where().cbegin() + offset_, length_}; }
+
+		object literal() const
+		{
+			switch (type_)
+			{
+				case NUMBER: return object{double_from_chars(lexeme())};
+				case STRING: return object{lexeme().substr(1, length_ - 2)}; // without the quotes
+				case TRUE_L: return object{true};
+				case FALSE_L: return object{false};
+				default: return object{};
+			}
+		}
+
+		location source_location() const { return location{where(), offset_}; }
 		std::size_t line() const { return source_location().line(); }
 
 	private:
-		token_type type_;
-		std::string_view lexeme_;
-		object literal_;
-		location location_;
-
+		std::uint32_t offset_ = 0;
+		std::uint32_t length_ = 0;
+		symbol_id symbol_ = no_symbol;
+		source::id_type source_id_ = 0;
+		token_type type_ = END_OF_FILE;
 	};
 
+	static_assert(sizeof(token) <= 16);
+
 	inline std::string str(token const& tok)
 	{
 		return fmt::format(
@@ -61,7 +101,7 @@ namespace lox {
 
 	inline void log_error(std::ostream& err_stream, token const& tok, std::string_view message)
 	{
-		auto const& loc = tok.source_location();
+		auto loc = tok.source_location();
 		auto [line_no, line_off, line] = loc.get_line();
 
 		err_stream << "in " << loc.where().name() << " (" << line_no << ':' << line_off << "): " << message << '\n';
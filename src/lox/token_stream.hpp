@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <iostream>
+
+#include "scanner.hpp"
+#include "source_file.hpp"
+#include "token.hpp"
+
+namespace lox {
+
+	// Scans a source on demand. The parser pulls tokens one at a time and
+	// only the last few are kept, in a small ring, so a script is never
+	// held as a whole token vector.
+	class token_stream
+	{
+		static constexpr std::size_t RING_SIZE = 8; // power of two
+
+		struct ring_sink
+		{
+			token_stream* stream;
+
+			void operator()(token&& tok)
+			{
+				stream->ring_[stream->scanned_++ & (RING_SIZE - 1)] = tok;
+			}
+		};
+
+	public:
+		// previous() plus the current token take two slots of the ring
+		static constexpr std::size_t MAX_LOOKAHEAD = RING_SIZE - 2;
+
+		explicit token_stream(source const& input, std::ostream& error = std::cerr)
+		: scanner_{input, ring_sink{this}, scanner_error_handler{error}}
+		{
+			fill(0);
+		}
+
+		// the scanner's sink points back here
+		token_stream(token_stream const&) = delete;
+		token_stream(token_stream&&) = delete;
+
+		token_stream& operator=(token_stream const&) = delete;
+		token_stream& operator=(token_stream&&) = delete;
+
+		bool had_error() const { return scanner_.had_error(); }
+
+		// The token `ahead` places past the current one. Past the end of
+		// input this is the END_OF_FILE token.
+		token const& peek(std::size_t ahead = 0)
+		{
+			assert(ahead <= MAX_LOOKAHEAD);
+			fill(ahead);
+			return slot(std::min(current_ + ahead, scanned_ - 1));
+		}
+
+		token const& previous() const
+		{
+			assert(current_ != 0);
+			return slot(current_ - 1);
+		}
+
+		// Moves past the current token, which becomes previous(). The end
+		// of input is never consumed.
+		token const& advance()
+		{
+			if (peek().type() != token_type::END_OF_FILE)
+			{
+				++current_;
+				fill(0);
+			}
+			return previous();
+		}
+
+	private:
+		scanner<ring_sink> scanner_;
+		std::array<token, RING_SIZE> ring_;
+		std::size_t scanned_ = 0; // tokens produced so far
+		std::size_t current_ = 0; // index of the current token
+
+		token const& slot(std::size_t index) const { return ring_[index & (RING_SIZE - 1)]; }
+
+		void fill(std::size_t ahead)
+		{
+			while (scanned_ <= current_ + ahead && scanner_.step())
+				;
+		}
+	};
+
+} // namespace lox
@@ -1,11 +1,12 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <string_view>
 
 namespace lox {
 
-	enum class token_type
+	enum class token_type : std::uint8_t
 	{
 		// single-character tokens
 		LEFT_PAREN, RIGHT_PAREN, LEFT_BRACE, RIGHT_BRACE,
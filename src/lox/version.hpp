@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace lox
+{
+	inline constexpr std::string_view version = "0.1.0";
+
+	// Bumped whenever the layout of flat::ast or its cache file changes.
+	inline constexpr std::uint32_t ast_format_version = 3;
+
+} // namespace lox
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../object.hpp"
+#include "../symbol.hpp"
+
+namespace lox::vm
+{
+	// Operands follow the opcode in the byte stream. Unless noted, 8-bit
+	// operands are slot/argument counts and 16-bit operands (big endian) index
+	// the chunk's constant, name or function tables, or are jump offsets.
+	enum class opcode : std::uint8_t
+	{
+		CONSTANT,       // u16 constant
+		NIL,
+		TRUE_L,
+		FALSE_L,
+		POP,
+
+		GET_LOCAL,      // u8 slot
+		SET_LOCAL,      // u8 slot
+		GET_UPVALUE,    // u8 index
+		SET_UPVALUE,    // u8 index
+		GET_GLOBAL,     // u16 name
+		SET_GLOBAL,     // u16 name
+		DEFINE_GLOBAL,  // u16 name
+
+		EQUAL,
+		NOT_EQUAL,
+		GREATER,
+		GREATER_EQUAL,
+		LESS,
+		LESS_EQUAL,
+		ADD,
+		SUBTRACT,
+		MULTIPLY,
+		DIVIDE,
+		NOT,
+		NEGATE,
+
+		PRINT,
+
+		JUMP,           // u16 forward offset
+		JUMP_IF_FALSE,  // u16 forward offset, condition left on the stack
+		LOOP,           // u16 backward offset
+
+		CALL,           // u8 argument count
+		CLOSURE,        // u16 function, then (u8 is_local, u8 index) per upvalue
+		CLOSE_UPVALUE,
+		RETURN
+	};
+
+	struct function;
+	using function_ptr = std::shared_ptr<const function>;
+
+	class chunk
+	{
+	public:
+		using code_t = std::vector<std::uint8_t>;
+
+		code_t const& code() const { return code_; }
+		std::size_t size() const { return code_.size(); }
+
+		void write(std::uint8_t byte) { code_.push_back(byte); }
+		void write(opcode op) { write(static_cast<std::uint8_t>(op)); }
+
+		void write_short(std::uint16_t value)
+		{
+			write(static_cast<std::uint8_t>(value >> 8));
+			write(static_cast<std::uint8_t>(value & 0xff));
+		}
+
+		void patch_short(std::size_t offset, std::uint16_t value)
+		{
+			assert(offset + 1 < code_.size());
+			code_[offset] = static_cast<std::uint8_t>(value >> 8);
+			code_[offset + 1] = static_cast<std::uint8_t>(value & 0xff);
+		}
+
+		std::size_t add_constant(object value)
+		{
+			constants_.push_back(std::move(value));
+			return constants_.size() - 1;
+		}
+
+		std::size_t add_name(symbol_id name)
+		{
+			for (std::size_t i{0}; i < names_.size(); ++i)
+			{
+				if (names_[i] == name)
+					return i;
+			}
+
+			names_.push_back(name);
+			return names_.size() - 1;
+		}
+
+		std::size_t add_function(function_ptr fn)
+		{
+			functions_.push_back(std::move(fn));
+			return functions_.size() - 1;
+		}
+
+		object const& constant(std::size_t index) const { assert(index < constants_.size()); return constants_[index]; }
+		symbol_id name(std::size_t index) const { assert(index < names_.size()); return names_[index]; }
+		function_ptr const& function_at(std::size_t index) const { assert(index < functions_.size()); return functions_[index]; }
+
+	private:
+		code_t code_;
+		std::vector<object> constants_;
+		std::vector<symbol_id> names_;
+		std::vector<function_ptr> functions_;
+	};
+
+	// A compiled function body. Closures created from it share the prototype.
+	struct function
+	{
+		std::string name;
+		std::size_t arity = 0;
+		std::size_t upvalue_count = 0;
+		chunk code;
+	};
+
+} // namespace lox::vm
@@ -0,0 +1,506 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "../expr.hpp"
+#include "../statement.hpp"
+#include "chunk.hpp"
+
+namespace lox::vm
+{
+	// Compiles a resolved program to bytecode. The resolver has already
+	// reported scoping errors, so the compiler only has to lay out locals and
+	// upvalues the same way and diagnose the limits of the encoding.
+	class compiler : expression::visitor, statement::visitor
+	{
+		static constexpr std::size_t MAX_LOCALS = std::numeric_limits<std::uint8_t>::max() + 1;
+		static constexpr std::size_t MAX_UPVALUES = std::numeric_limits<std::uint8_t>::max() + 1;
+		static constexpr std::size_t MAX_INDEX = std::numeric_limits<std::uint16_t>::max();
+
+		struct local
+		{
+			symbol_id name;
+			int depth;
+			bool captured;
+		};
+
+		struct upvalue_ref
+		{
+			std::uint8_t index;
+			bool is_local;
+		};
+
+		struct function_state
+		{
+			function_state* enclosing;
+			std::shared_ptr<function> fn;
+			std::vector<local> locals;
+			std::vector<upvalue_ref> upvalues;
+			int scope_depth;
+		};
+
+	public:
+		explicit compiler(std::ostream& error)
+		: error_{&error}
+		{ }
+
+		compiler(compiler const&) = delete;
+		compiler(compiler&&) = default;
+
+		compiler& operator=(compiler const&) = delete;
+		compiler& operator=(compiler&&) = default;
+
+		bool had_error() const { return had_error_; }
+
+		// Compiles top-level statements into an argument-less "script" function.
+		function_ptr compile(std::vector<statement_ptr> const& statements)
+		{
+			function_state script{nullptr, std::make_shared<function>(), {}, {}, 0};
+			script.fn->name = "<script>";
+			begin_function(script);
+
+			for (auto&& stmt : statements)
+				compile(*stmt);
+
+			return end_function();
+		}
+
+		//
+		// statements
+		//
+		void visit(block_stmt const& stmt) override
+		{
+			begin_scope();
+			for (auto&& s : stmt.statements())
+				compile(*s);
+			end_scope();
+		}
+
+		void visit(expression_stmt const& stmt) override
+		{
+			compile(stmt.expr());
+			emit(opcode::POP);
+		}
+
+		void visit(for_stmt const& stmt) override
+		{
+			begin_scope();
+			if (auto&& initializer = stmt.initializer())
+				compile(*initializer);
+
+			auto loop_start{current_chunk().size()};
+			compile(stmt.condition());
+
+			auto exit_jump{emit_jump(opcode::JUMP_IF_FALSE)};
+			emit(opcode::POP);
+			compile(stmt.body());
+			if (auto&& increment = stmt.increment())
+			{
+				compile(*increment);
+				emit(opcode::POP);
+			}
+			emit_loop(loop_start);
+
+			patch_jump(exit_jump);
+			emit(opcode::POP);
+			end_scope();
+		}
+
+		void visit(func_stmt const& stmt) override
+		{
+			if (is_local_scope())
+			{
+				// declared before the body so the function can refer to itself.
+				add_local(stmt.name());
+				compile_function(stmt);
+			}
+			else
+			{
+				compile_function(stmt);
+				emit_indexed(opcode::DEFINE_GLOBAL, name_index(stmt.name().symbol()));
+			}
+		}
+
+		void visit(if_stmt const& stmt) override
+		{
+			compile(stmt.condition());
+			auto then_jump{emit_jump(opcode::JUMP_IF_FALSE)};
+			emit(opcode::POP);
+			compile(stmt.then_branch());
+
+			auto else_jump{emit_jump(opcode::JUMP)};
+			patch_jump(then_jump);
+			emit(opcode::POP);
+
+			if (auto&& else_branch = stmt.else_branch())
+				compile(*else_branch);
+
+			patch_jump(else_jump);
+		}
+
+		void visit(print_stmt const& stmt) override
+		{
+			compile(stmt.expr());
+			emit(opcode::PRINT);
+		}
+
+		void visit(return_stmt const& stmt) override
+		{
+			if (auto&& value = stmt.value())
+				compile(*value);
+			else
+				emit(opcode::NIL);
+
+			emit(opcode::RETURN);
+		}
+
+		void visit(var_stmt const& stmt) override
+		{
+			if (stmt.initializer())
+				compile(*stmt.initializer());
+			else
+				emit(opcode::NIL);
+
+			if (is_local_scope())
+				add_local(stmt.name());
+			else
+				emit_indexed(opcode::DEFINE_GLOBAL, name_index(stmt.name().symbol()));
+		}
+
+		void visit(while_stmt const& stmt) override
+		{
+			auto loop_start{current_chunk().size()};
+			compile(stmt.condition());
+
+			auto exit_jump{emit_jump(opcode::JUMP_IF_FALSE)};
+			emit(opcode::POP);
+			compile(stmt.body());
+			emit_loop(loop_start);
+
+			patch_jump(exit_jump);
+			emit(opcode::POP);
+		}
+
+		//
+		// expressions
+		//
+		void visit(assign const& expr) override
+		{
+			compile(expr.value());
+			emit_variable(expr.name_token(), opcode::SET_LOCAL, opcode::SET_UPVALUE, opcode::SET_GLOBAL);
+		}
+
+		void visit(binary const& expr) override
+		{
+			compile(expr.left());
+			compile(expr.right());
+
+			switch (expr.op())
+			{
+				case binary_op::NOT_EQUAL: emit(opcode::NOT_EQUAL); break;
+				case binary_op::EQUAL: emit(opcode::EQUAL); break;
+				case binary_op::GREATER: emit(opcode::GREATER); break;
+				case binary_op::GREATER_EQUAL: emit(opcode::GREATER_EQUAL); break;
+				case binary_op::LESS: emit(opcode::LESS); break;
+				case binary_op::LESS_EQUAL: emit(opcode::LESS_EQUAL); break;
+				case binary_op::SUBTRACT: emit(opcode::SUBTRACT); break;
+				case binary_op::ADD: emit(opcode::ADD); break;
+				case binary_op::DIVIDE: emit(opcode::DIVIDE); break;
+				case binary_op::MULTIPLY: emit(opcode::MULTIPLY); break;
+			}
+		}
+
+		void visit(call const& expr) override
+		{
+			compile(expr.callee());
+			for (auto&& arg : expr.arguments())
+				compile(*arg);
+
+			emit(opcode::CALL);
+			emit(static_cast<std::uint8_t>(expr.arguments().size()));
+		}
+
+		void visit(grouping const& expr) override
+		{
+			compile(expr.expr());
+		}
+
+		void visit(literal const& expr) override
+		{
+			auto const& value{expr.value()};
+			switch (value.get_type())
+			{
+				case object::type::NIL:
+					emit(opcode::NIL);
+					break;
+
+				case object::type::BOOL:
+					emit(static_cast<bool>(value) ? opcode::TRUE_L : opcode::FALSE_L);
+					break;
+
+				default:
+					emit_indexed(opcode::CONSTANT, checked_index(current_chunk().add_constant(value), "Too many constants in one chunk."));
+					break;
+			}
+		}
+
+		void visit(logical const& expr) override
+		{
+			compile(expr.left());
+
+			if (expr.op() == logical_op::OR)
+			{
+				auto else_jump{emit_jump(opcode::JUMP_IF_FALSE)};
+				auto end_jump{emit_jump(opcode::JUMP)};
+
+				patch_jump(else_jump);
+				emit(opcode::POP);
+				compile(expr.right());
+				patch_jump(end_jump);
+			}
+			else
+			{
+				auto end_jump{emit_jump(opcode::JUMP_IF_FALSE)};
+				emit(opcode::POP);
+				compile(expr.right());
+				patch_jump(end_jump);
+			}
+		}
+
+		void visit(unary const& expr) override
+		{
+			compile(expr.right());
+
+			switch (expr.op())
+			{
+				case unary_op::NOT: emit(opcode::NOT); break;
+				case unary_op::NEGATE: emit(opcode::NEGATE); break;
+			}
+		}
+
+		void visit(variable const& expr) override
+		{
+			emit_variable(expr.name_token(), opcode::GET_LOCAL, opcode::GET_UPVALUE, opcode::GET_GLOBAL);
+		}
+
+	private:
+		std::ostream* error_;
+		function_state* current_ = nullptr;
+		bool had_error_ = false;
+
+		chunk& current_chunk() { assert(current_); return current_->fn->code; }
+		bool is_local_scope() const { assert(current_); return current_->scope_depth > 0; }
+
+		void compile(statement const& stmt) { stmt.accept(*this); }
+		void compile(expression const& expr) { expr.accept(*this); }
+
+		void begin_function(function_state& state)
+		{
+			state.enclosing = current_;
+			current_ = &state;
+
+			// slot zero holds the callee while the function runs.
+			state.locals.push_back(local{no_symbol, 0, false});
+		}
+
+		function_ptr end_function()
+		{
+			assert(current_);
+
+			emit(opcode::NIL);
+			emit(opcode::RETURN);
+
+			auto fn{current_->fn};
+			fn->upvalue_count = current_->upvalues.size();
+			current_ = current_->enclosing;
+			return fn;
+		}
+
+		void compile_function(func_stmt const& stmt)
+		{
+			function_state state{nullptr, std::make_shared<function>(), {}, {}, 0};
+			state.fn->name = std::string{stmt.name().lexeme()};
+			state.fn->arity = stmt.parameters().size();
+
+			begin_function(state);
+			begin_scope();
+
+			for (auto&& param : stmt.parameters())
+				add_local(param);
+
+			for (auto&& s : stmt.body())
+				compile(*s);
+
+			// no end_scope(): returning closes over, and discards, every local.
+			auto fn{end_function()};
+
+			emit_indexed(opcode::CLOSURE, checked_index(current_chunk().add_function(fn), "Too many functions in one chunk."));
+			for (auto&& uv : state.upvalues)
+			{
+				emit(static_cast<std::uint8_t>(uv.is_local ? 1 : 0));
+				emit(uv.index);
+			}
+		}
+
+		void begin_scope()
+		{
+			++current_->scope_depth;
+		}
+
+		void end_scope()
+		{
+			--current_->scope_depth;
+
+			auto& locals{current_->locals};
+			while (!locals.empty() && locals.back().depth > current_->scope_depth)
+			{
+				emit(locals.back().captured ? opcode::CLOSE_UPVALUE : opcode::POP);
+				locals.pop_back();
+			}
+		}
+
+		void add_local(token const& name)
+		{
+			if (current_->locals.size() >= MAX_LOCALS)
+			{
+				error(name, "Too many local variables in function.");
+				return;
+			}
+
+			current_->locals.push_back(local{name.symbol(), current_->scope_depth, false});
+		}
+
+		static std::optional<std::uint8_t> resolve_local(function_state& state, symbol_id name)
+		{
+			for (auto i{state.locals.size()}; i > 0; --i)
+			{
+				if (state.locals[i - 1].name == name)
+					return static_cast<std::uint8_t>(i - 1);
+			}
+			return std::nullopt;
+		}
+
+		std::optional<std::uint8_t> resolve_upvalue(function_state& state, token const& name)
+		{
+			if (state.enclosing == nullptr)
+				return std::nullopt;
+
+			if (auto index = resolve_local(*state.enclosing, name.symbol()))
+			{
+				state.enclosing->locals[*index].captured = true;
+				return add_upvalue(state, name, *index, true);
+			}
+
+			if (auto index = resolve_upvalue(*state.enclosing, name))
+				return add_upvalue(state, name, *index, false);
+
+			return std::nullopt;
+		}
+
+		std::uint8_t add_upvalue(function_state& state, token const& name, std::uint8_t index, bool is_local)
+		{
+			auto& upvalues{state.upvalues};
+			for (std::size_t i{0}; i < upvalues.size(); ++i)
+			{
+				if (upvalues[i].index == index && upvalues[i].is_local == is_local)
+					return static_cast<std::uint8_t>(i);
+			}
+
+			if (upvalues.size() >= MAX_UPVALUES)
+			{
+				error(name, "Too many closure variables in function.");
+				return 0;
+			}
+
+			upvalues.push_back(upvalue_ref{index, is_local});
+			return static_cast<std::uint8_t>(upvalues.size() - 1);
+		}
+
+		std::uint16_t name_index(symbol_id name)
+		{
+			return checked_index(current_chunk().add_name(name), "Too many global names in one chunk.");
+		}
+
+		std::uint16_t checked_index(std::size_t index, std::string_view message)
+		{
+			if (index > MAX_INDEX)
+			{
+				error(message);
+				return 0;
+			}
+			return static_cast<std::uint16_t>(index);
+		}
+
+		void emit_variable(token const& name, opcode local_op, opcode upvalue_op, opcode global_op)
+		{
+			if (auto slot = resolve_local(*current_, name.symbol()))
+			{
+				emit(local_op);
+				emit(*slot);
+			}
+			else if (auto index = resolve_upvalue(*current_, name))
+			{
+				emit(upvalue_op);
+				emit(*index);
+			}
+			else
+				emit_indexed(global_op, name_index(name.symbol()));
+		}
+
+		void emit(opcode op) { current_chunk().write(op); }
+		void emit(std::uint8_t byte) { current_chunk().write(byte); }
+
+		void emit_indexed(opcode op, std::uint16_t index)
+		{
+			emit(op);
+			current_chunk().write_short(index);
+		}
+
+		std::size_t emit_jump(opcode op)
+		{
+			emit(op);
+			current_chunk().write_short(0xffff);
+			return current_chunk().size() - 2;
+		}
+
+		void patch_jump(std::size_t offset)
+		{
+			// -2 to adjust for the jump offset itself.
+			auto jump{current_chunk().size() - offset - 2};
+			if (jump > MAX_INDEX)
+				error("Too much code to jump over.");
+
+			current_chunk().patch_short(offset, static_cast<std::uint16_t>(jump));
+		}
+
+		void emit_loop(std::size_t loop_start)
+		{
+			emit(opcode::LOOP);
+
+			auto offset{current_chunk().size() - loop_start + 2};
+			if (offset > MAX_INDEX)
+				error("Loop body too large.");
+
+			current_chunk().write_short(static_cast<std::uint16_t>(offset));
+		}
+
+		void error(token const& where, std::string_view message)
+		{
+			had_error_ = true;
+			::lox::log_error(*error_, where, message);
+		}
+
+		void error(std::string_view message)
+		{
+			had_error_ = true;
+			*error_ << "compile error: " << message << '\n';
+		}
+	};
+
+} // namespace lox::vm
@@ -0,0 +1,445 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <vector>
+#include <fmt/format.h>
+
+#include "../callable.hpp"
+#include "../exceptions.hpp"
+#include "../interpreter.hpp"
+#include "../object.hpp"
+#include "chunk.hpp"
+
+namespace lox::vm
+{
+	class machine;
+
+	// A captured variable. While the variable is still on the stack the
+	// upvalue is "open" and points at the stack slot; once the slot goes out
+	// of scope the value is moved into the upvalue itself.
+	struct upvalue final : gc_object
+	{
+		explicit upvalue(object* slot)
+		: location{slot}
+		{
+			track();
+		}
+
+		object* location;
+		object closed;
+
+		// an open upvalue's stack slot is owned by the machine
+		void trace(tracer& t) const override { closed.trace(t); }
+
+	protected:
+		void clear_references() override { closed = object{}; }
+	};
+
+	using upvalue_ptr = ref_ptr<upvalue>;
+
+	class closure final : public callable::impl
+	{
+	public:
+		closure(machine& vm, function_ptr fn, std::vector<upvalue_ptr>&& upvalues)
+		: vm_{&vm}
+		, fn_{std::move(fn)}
+		, upvalues_{std::move(upvalues)}
+		{
+			assert(fn_);
+			track();
+		}
+
+		function const& fn() const { return *fn_; }
+		upvalue& upvalue_at(std::size_t index) const { assert(index < upvalues_.size()); return *upvalues_[index]; }
+		upvalue_ptr const& upvalue_ptr_at(std::size_t index) const { assert(index < upvalues_.size()); return upvalues_[index]; }
+
+		std::size_t arity() const override { return fn_->arity; }
+		object call(interpreter& inter, std::span<const object> arguments) const override;
+		std::string name() const override { return fn_->name; }
+		std::string str() const override { return fmt::format("<fn {}>", name()); }
+
+		void trace(tracer& t) const override
+		{
+			for (auto&& uv : upvalues_)
+				t(uv.get());
+		}
+
+	protected:
+		void clear_references() override { upvalues_.clear(); }
+
+	private:
+		machine* vm_;
+		function_ptr fn_;
+		std::vector<upvalue_ptr> upvalues_;
+	};
+
+	// Stack-based bytecode interpreter. Globals and builtins are shared with
+	// the tree-walking interpreter, so both engines see the same global
+	// environment; builtins called from bytecode see only that environment.
+	class machine
+	{
+		// Lox calls don't recurse natively, so these only bound memory; they
+		// allow at least the depth the tree-walker reaches
+		static constexpr std::size_t FRAMES_MAX = std::size_t{1} << 14;
+		static constexpr std::size_t STACK_MAX = std::size_t{1} << 20;
+
+		struct call_frame
+		{
+			closure const* fn;
+			std::uint8_t const* ip;
+			object* slots;
+		};
+
+	public:
+		machine(interpreter& inter, std::ostream& out)
+		: inter_{&inter}
+		, out_{&out}
+		, stack_{std::make_unique<object[]>(STACK_MAX)}
+		, sp_{stack_.get()}
+		, frames_{std::make_unique_for_overwrite<call_frame[]>(FRAMES_MAX)}
+		{ }
+
+		// closures point back at their machine
+		machine(machine const&) = delete;
+		machine(machine&&) = delete;
+
+		machine& operator=(machine const&) = delete;
+		machine& operator=(machine&&) = delete;
+
+		void interpret(function_ptr script)
+		{
+			assert(frame_count_ == 0);
+
+			auto fn{make_ref<closure>(*this, std::move(script), std::vector<upvalue_ptr>{})};
+			push(object{callable{fn}});
+			call_closure(*fn, 0);
+
+			guarded_run(0);
+			reset();
+		}
+
+		// Calls a closure from native code, e.g. a builtin or the tree-walker.
+		object call(closure const& fn, std::span<const object> arguments)
+		{
+			const auto base{frame_count_};
+
+			push(object{});
+			for (auto&& arg : arguments)
+				push(arg);
+
+			call_closure(fn, arguments.size());
+			guarded_run(base);
+
+			return pop();
+		}
+
+	private:
+		interpreter* inter_;
+		std::ostream* out_;
+		std::unique_ptr<object[]> stack_;
+		object* sp_;
+		std::unique_ptr<call_frame[]> frames_;
+		std::size_t frame_count_ = 0;
+		std::vector<upvalue_ptr> open_upvalues_; // ordered by stack slot
+
+		void push(object value)
+		{
+			if (sp_ == stack_.get() + STACK_MAX)
+				throw runtime_error{"Stack overflow."};
+			*sp_++ = std::move(value);
+		}
+
+		object pop()
+		{
+			assert(sp_ > stack_.get());
+			return std::move(*--sp_);
+		}
+
+		object& peek(std::size_t distance)
+		{
+			assert(sp_ - stack_.get() > static_cast<std::ptrdiff_t>(distance));
+			return sp_[-1 - static_cast<std::ptrdiff_t>(distance)];
+		}
+
+		// pop() without handing the value back
+		void drop()
+		{
+			assert(sp_ > stack_.get());
+			if (sp_[-1].is_double())
+				--sp_; // nothing to release; the next push overwrites it
+			else
+				*--sp_ = object{};
+		}
+
+		// Replaces the top two values with `op` applied to them. Numbers are
+		// combined in place; anything else goes through object's operators,
+		// which raise the type errors.
+		template<class Op>
+		void binary(Op op)
+		{
+			assert(sp_ - stack_.get() >= 2);
+			auto& lhs{sp_[-2]};
+			auto const& rhs{sp_[-1]};
+			if (lhs.is_double() && rhs.is_double())
+			{
+				lhs = object{op(lhs.as_number(), rhs.as_number())};
+				--sp_; // rhs is a number, so there is nothing to release
+				return;
+			}
+
+			auto b{pop()};
+			peek(0) = object{op(peek(0), b)};
+		}
+
+		void discard(object* new_top)
+		{
+			while (sp_ > new_top)
+				*--sp_ = object{};
+		}
+
+		void reset()
+		{
+			// closures that escaped before an error keep their values
+			close_upvalues(stack_.get());
+			discard(stack_.get());
+			frame_count_ = 0;
+			open_upvalues_.clear();
+		}
+
+		void guarded_run(std::size_t base)
+		{
+			try
+			{
+				run(base);
+			}
+			catch(...)
+			{
+				reset();
+				throw;
+			}
+		}
+
+		void call_closure(closure const& fn, std::size_t argc)
+		{
+			if (frame_count_ == FRAMES_MAX)
+				throw runtime_error{"Stack overflow."};
+
+			frames_[frame_count_++] = call_frame{&fn, fn.fn().code.code().data(), sp_ - argc - 1};
+		}
+
+		void call_value(std::size_t argc)
+		{
+			auto fn{peek(argc).as_callable()};
+			if (fn == nullptr)
+				throw type_error{"Only functions and classes are callable."};
+
+			auto c{dynamic_cast<closure const*>(fn)};
+			auto arity{c ? c->fn().arity : fn->arity()};
+			if (argc != arity)
+				throw runtime_error{
+					fmt::format("Exepcted {} arguments but got {}.", arity, argc)
+				};
+
+			if (c)
+			{
+				call_closure(*c, argc);
+				return;
+			}
+
+			auto result{fn->call(*inter_, std::span<const object>{sp_ - argc, argc})};
+			discard(sp_ - argc - 1);
+			push(std::move(result));
+		}
+
+		upvalue_ptr capture_upvalue(object* slot)
+		{
+			auto i{open_upvalues_.size()};
+			for (; i > 0 && open_upvalues_[i - 1]->location >= slot; --i)
+			{
+				if (open_upvalues_[i - 1]->location == slot)
+					return open_upvalues_[i - 1];
+			}
+
+			auto uv{make_ref<upvalue>(slot)};
+			open_upvalues_.insert(open_upvalues_.begin() + static_cast<std::ptrdiff_t>(i), uv);
+			return uv;
+		}
+
+		void close_upvalues(object* last)
+		{
+			while (!open_upvalues_.empty() && open_upvalues_.back()->location >= last)
+			{
+				auto& uv{*open_upvalues_.back()};
+				uv.closed = *uv.location;
+				uv.location = &uv.closed;
+				open_upvalues_.pop_back();
+			}
+		}
+
+		void run(std::size_t base)
+		{
+			call_frame* frame{&frames_[frame_count_ - 1]};
+			std::uint8_t const* ip{frame->ip};
+
+			auto read_byte = [&ip]() { return *ip++; };
+			auto read_short = [&ip]()
+			{
+				ip += 2;
+				return static_cast<std::uint16_t>((ip[-2] << 8) | ip[-1]);
+			};
+			auto current_chunk = [&frame]() -> chunk const& { return frame->fn->fn().code; };
+
+			for (;;)
+			{
+				switch (static_cast<opcode>(read_byte()))
+				{
+					case opcode::CONSTANT:
+						push(current_chunk().constant(read_short()));
+						break;
+
+					case opcode::NIL: push(object{}); break;
+					case opcode::TRUE_L: push(object{true}); break;
+					case opcode::FALSE_L: push(object{false}); break;
+					case opcode::POP: drop(); break;
+
+					case opcode::GET_LOCAL:
+						push(frame->slots[read_byte()]);
+						break;
+
+					case opcode::SET_LOCAL:
+						frame->slots[read_byte()] = peek(0);
+						break;
+
+					case opcode::GET_UPVALUE:
+						push(*frame->fn->upvalue_at(read_byte()).location);
+						break;
+
+					case opcode::SET_UPVALUE:
+						*frame->fn->upvalue_at(read_byte()).location = peek(0);
+						break;
+
+					case opcode::GET_GLOBAL:
+						push(inter_->global_env().get(current_chunk().name(read_short())));
+						break;
+
+					case opcode::SET_GLOBAL:
+						inter_->global_env().assign(current_chunk().name(read_short()), peek(0));
+						break;
+
+					case opcode::DEFINE_GLOBAL:
+						inter_->global_env().define(current_chunk().name(read_short()), pop());
+						break;
+
+					case opcode::EQUAL: binary(std::equal_to{}); break;
+					case opcode::NOT_EQUAL: binary(std::not_equal_to{}); break;
+					case opcode::GREATER: binary(std::greater{}); break;
+					case opcode::GREATER_EQUAL: binary(std::greater_equal{}); break;
+					case opcode::LESS: binary(std::less{}); break;
+					case opcode::LESS_EQUAL: binary(std::less_equal{}); break;
+					case opcode::ADD: binary(std::plus{}); break;
+					case opcode::SUBTRACT: binary(std::minus{}); break;
+					case opcode::MULTIPLY: binary(std::multiplies{}); break;
+					case opcode::DIVIDE: binary(std::divides{}); break;
+
+					case opcode::NOT:
+						peek(0) = !peek(0);
+						break;
+
+					case opcode::NEGATE:
+						peek(0) = -peek(0);
+						break;
+
+					case opcode::PRINT:
+						*out_ << pop().str() << std::endl;
+						break;
+
+					case opcode::JUMP:
+					{
+						auto offset{read_short()};
+						ip += offset;
+						break;
+					}
+
+					case opcode::JUMP_IF_FALSE:
+					{
+						auto offset{read_short()};
+						if (!static_cast<bool>(peek(0)))
+							ip += offset;
+						break;
+					}
+
+					case opcode::LOOP:
+					{
+						auto offset{read_short()};
+						ip -= offset;
+						break;
+					}
+
+					case opcode::CALL:
+					{
+						auto argc{read_byte()};
+						frame->ip = ip;
+						call_value(argc);
+						frame = &frames_[frame_count_ - 1];
+						ip = frame->ip;
+						break;
+					}
+
+					case opcode::CLOSURE:
+					{
+						heap::get().maybe_collect();
+						auto const& fn{current_chunk().function_at(read_short())};
+
+						std::vector<upvalue_ptr> upvalues;
+						upvalues.reserve(fn->upvalue_count);
+						for (std::size_t i{0}; i < fn->upvalue_count; ++i)
+						{
+							auto is_local{read_byte()};
+							auto index{read_byte()};
+							upvalues.push_back(is_local ? capture_upvalue(frame->slots + index) : frame->fn->upvalue_ptr_at(index));
+						}
+
+						push(object{callable{make_ref<closure>(*this, fn, std::move(upvalues))}});
+						break;
+					}
+
+					case opcode::CLOSE_UPVALUE:
+						close_upvalues(sp_ - 1);
+						(void)pop();
+						break;
+
+					case opcode::RETURN:
+					{
+						auto result{pop()};
+						close_upvalues(frame->slots);
+						discard(frame->slots);
+						--frame_count_;
+
+						push(std::move(result));
+						if (frame_count_ == base)
+							return;
+
+						frame = &frames_[frame_count_ - 1];
+						ip = frame->ip;
+						break;
+					}
+
+					default:
+						LOX_THROW(programming_error, fmt::format("unknown opcode: {}", static_cast<int>(ip[-1])));
+				}
+			}
+		}
+	};
+
+	inline object closure::call(interpreter& inter, std::span<const object> arguments) const
+	{
+		ignore_unused(inter);
+		return vm_->call(*this, arguments);
+	}
+
+} // namespace lox::vm
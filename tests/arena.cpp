@@ -0,0 +1,47 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "lox/arena.hpp"
+
+using namespace lox;
+
+BOOST_AUTO_TEST_CASE(arena_destroys_in_reverse)
+{
+	std::vector<int> destroyed;
+
+	struct tracked
+	{
+		std::vector<int>* log;
+		int id;
+		~tracked() { log->push_back(id); }
+	};
+
+	{
+		arena a;
+		for (int i = 0; i < 3; ++i)
+			a.make<tracked>(&destroyed, i);
+		BOOST_TEST(destroyed.empty());
+	}
+
+	BOOST_TEST(destroyed == (std::vector<int>{2, 1, 0}));
+}
+
+BOOST_AUTO_TEST_CASE(arena_alignment_and_large_objects)
+{
+	struct alignas(32) wide { char bytes[32]; };
+	struct big { char bytes[100 * 1024]; };
+
+	arena a;
+	(void)a.make<char>('x');
+	auto w{a.make<wide>()};
+	BOOST_TEST(reinterpret_cast<std::uintptr_t>(w) % 32 == 0u);
+
+	auto b{a.make<big>()};
+	b->bytes[sizeof(b->bytes) - 1] = 1;
+
+	auto s{a.make<std::string>(64, 'a')};
+	BOOST_TEST(*s == std::string(64, 'a'));
+	BOOST_TEST(a.used() >= sizeof(big));
+}
@@ -29,3 +29,14 @@ BOOST_AUTO_TEST_CASE(builtin_dir)
 	BOOST_TEST(value.str() == "{clock, dir}");
 }
 
+BOOST_AUTO_TEST_CASE(builtin_dir_globals)
+{
+	std::stringstream in, out, err;
+	interpreter inter{&in, &out, &err};
+	inter.global_env().define(intern("zeta"), object{1.0});
+	inter.global_env().define(intern("alpha"), object{2.0});
+	auto func{callable::make<lox::builtin::dir>()};
+	object value{func(inter, std::vector<object>{})};
+
+	BOOST_TEST(value.str() == "{alpha, clock, dir, zeta}");
+}
@@ -0,0 +1,211 @@
+#include <filesystem>
+#include <tuple>
+#include <sstream>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+
+#include "lox/lox.hpp"
+#include "lox/utility.hpp"
+
+using namespace lox;
+using namespace std::literals::string_literals;
+
+template<typename T, typename U>
+inline std::tuple<bool, bool, std::string, std::string> run_output(T&& name, U&& source, lox::engine engine)
+{
+	std::istringstream stdin;
+	std::ostringstream stdout, stderr;
+	string_source s{std::forward<T>(name), std::forward<U>(source)};
+	Lox intrpr{&stdin, &stdout, &stderr};
+	intrpr.engine(engine);
+	intrpr.run(s);
+
+	return std::make_tuple(intrpr.had_parse_error(), intrpr.had_runtime_error(), trim(stdout.str()), trim(stderr.str()));
+}
+
+BOOST_AUTO_TEST_CASE(flat_matches_tree)
+{
+	auto test = R"test(
+var a = "global";
+{
+	var a = "outer";
+	{
+		var b = a;
+		a = "assigned";
+		print b;
+	}
+	print a;
+}
+print a;
+
+fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+print fib(15);
+
+fun counter() {
+	var i = 0;
+	fun next() { i = i + 1; return i; }
+	return next;
+}
+var c = counter();
+c();
+print c();
+
+var n = 0;
+while (n < 3) n = n + 1;
+print n;
+for (var i = 0; i < 3; i = i + 1) n = n + i;
+print n;
+print nil or "default";
+print !(1 == 2) and -n < 0;
+)test"s;
+
+	auto [tree_parse_error, tree_runtime_error, tree_output, tree_error] = run_output("flat-tree", test, engine::tree_walker);
+	auto [had_parse_error, had_runtime_error, output, error] = run_output("flat", test, engine::flat);
+
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+	BOOST_REQUIRE_EQUAL(output, tree_output);
+	BOOST_REQUIRE_EQUAL(output, "outer\nassigned\nglobal\n610\n2\n3\n6\ndefault\ntrue"s);
+}
+
+BOOST_AUTO_TEST_CASE(flat_runtime_error)
+{
+	auto [had_parse_error, had_runtime_error, output, error] = run_output("flat-error", "fun f(a) {}\nprint 1;\nf();"s, engine::flat);
+
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(had_runtime_error);
+	BOOST_REQUIRE_EQUAL(output, "1"s);
+	BOOST_REQUIRE_EQUAL(error, "Exepcted 1 arguments but got 0."s);
+}
+
+BOOST_AUTO_TEST_CASE(flat_layout)
+{
+	string_source s{"flat-layout", "var a = 1;\n{ var b = a + 2; print b; }"s};
+	token_stream tokens{s};
+	parser p{tokens};
+	auto [had_error, unit] = p.parse();
+	BOOST_REQUIRE(!had_error);
+
+	auto tree{flat::ast::flatten(*unit)};
+	BOOST_REQUIRE_EQUAL(tree->roots().size(), 2u);
+
+	// children come before their parents
+	auto block{tree->roots()[1]};
+	BOOST_TEST((tree->kind(block) == flat::node_kind::BLOCK));
+	auto body{tree->list(tree->b(block))};
+	BOOST_REQUIRE_EQUAL(body.size(), 2u);
+	for (auto stmt : body)
+		BOOST_TEST(stmt < block);
+
+	auto sum{tree->a(body[0])};
+	BOOST_TEST((tree->kind(sum) == flat::node_kind::BINARY));
+	BOOST_TEST((tree->op(sum) == token_type::PLUS));
+
+	std::ostringstream error;
+	flat::resolver res{error};
+	res.resolve(*tree);
+	BOOST_TEST(!res.had_error());
+
+	// `a` is global, `b` the block's first slot
+	auto a{tree->a(sum)};
+	BOOST_TEST(tree->local(a) == nullptr);
+	auto b{tree->a(body[1])};
+	BOOST_REQUIRE(tree->local(b) != nullptr);
+	BOOST_TEST(tree->local(b)->depth == 0u);
+	BOOST_TEST(tree->local(b)->slot == 0u);
+
+	BOOST_TEST(tree->footprint() < unit->memory().used());
+}
+
+BOOST_AUTO_TEST_CASE(flat_cache_round_trip)
+{
+	auto test = R"test(
+var greeting = "cached";
+fun twice(f, x) { return f(f(x)); }
+fun inc(n) { var one = 1; return n + one; }
+print twice(inc, 40);
+print greeting;
+print nil == false;
+)test"s;
+
+	auto path{std::filesystem::temp_directory_path() / fmt::format("lox-cache-test-{}.loxc", ::getpid())};
+	std::filesystem::remove(path);
+
+	string_source s{"flat-cache", test};
+	auto key{flat::cache_key::of(s)};
+
+	for (int run = 0; run < 2; ++run)
+	{
+		std::istringstream stdin;
+		std::ostringstream stdout, stderr;
+		Lox intrpr{&stdin, &stdout, &stderr};
+		intrpr.run_cached(s, path);
+
+		BOOST_TEST(!intrpr.had_parse_error());
+		BOOST_TEST(!intrpr.had_runtime_error());
+		BOOST_REQUIRE_EQUAL(stderr.str(), ""s);
+		BOOST_REQUIRE_EQUAL(stdout.str(), "42\ncached\nfalse\n"s);
+		BOOST_TEST(std::filesystem::exists(path));
+	}
+
+	BOOST_TEST(flat::ast_file::load(path, key, s) != nullptr);
+
+	// a different source, or a damaged file, is a miss
+	string_source changed{"flat-cache", test + " "};
+	BOOST_TEST(flat::ast_file::load(path, flat::cache_key::of(changed), changed) == nullptr);
+
+	std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+	BOOST_TEST(flat::ast_file::load(path, key, s) == nullptr);
+
+	std::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(flat_cache_dead_branch_error)
+{
+	auto test = R"test(
+if (false) { return 1; }
+print "ran";
+)test"s;
+
+	auto path{std::filesystem::temp_directory_path() / fmt::format("lox-cache-dead-{}.loxc", ::getpid())};
+	std::filesystem::remove(path);
+
+	string_source s{"flat-cache-dead", test};
+
+	for (int run = 0; run < 2; ++run)
+	{
+		std::istringstream stdin;
+		std::ostringstream stdout, stderr;
+		Lox intrpr{&stdin, &stdout, &stderr};
+		intrpr.run_cached(s, path);
+
+		BOOST_REQUIRE_EQUAL(stdout.str(), ""s);
+		BOOST_TEST(stderr.str().find("Cannot return from top-level code.") != std::string::npos);
+		BOOST_TEST(!std::filesystem::exists(path));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(flat_cache_empty_columns)
+{
+	// no locals and no lists, so those columns are empty in the file
+	auto path{std::filesystem::temp_directory_path() / fmt::format("lox-cache-empty-{}.loxc", ::getpid())};
+	std::filesystem::remove(path);
+
+	string_source s{"flat-cache-empty", "print 1;"s};
+	auto key{flat::cache_key::of(s)};
+
+	for (int run = 0; run < 2; ++run)
+	{
+		std::istringstream stdin;
+		std::ostringstream stdout, stderr;
+		Lox intrpr{&stdin, &stdout, &stderr};
+		intrpr.run_cached(s, path);
+
+		BOOST_REQUIRE_EQUAL(stderr.str(), ""s);
+		BOOST_REQUIRE_EQUAL(stdout.str(), "1\n"s);
+	}
+
+	BOOST_TEST(flat::ast_file::load(path, key, s) != nullptr);
+	std::filesystem::remove(path);
+}
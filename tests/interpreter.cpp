@@ -273,6 +273,142 @@ for (var b = 1; a < 10000; b = temp + b) {
 }
 
 
+BOOST_AUTO_TEST_CASE(interpreter_for_scope)
+{
+	auto test = R"test(
+var i = "outer";
+var last;
+fun first_over(limit) {
+	for (var i = 0;; i = i + 1) {
+		fun seen() { return i; }
+		last = seen;
+		if (i > limit) return i;
+	}
+}
+print first_over(2);
+print last();
+for (var i = 0; i < 2; i = i + 1) i = i + 0;
+print i;
+var n = 0;
+for (; n < 3;) n = n + 1;
+print n;
+)test"s;
+
+	auto [had_error, had_parse_error, had_runtime_error, output, error] = run_test_case_output("for-scope", test);
+
+	BOOST_TEST(!had_error);
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+	BOOST_REQUIRE_EQUAL(output, "3\n3\nouter\n3"s);
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_block_scope_elision)
+{
+	auto test = R"test(
+var a = "global";
+{
+	var a = "outer";
+	{
+		{ print a; }
+		{ a = "assigned"; }
+		{ var a = "inner"; { print a; } }
+	}
+	print a;
+}
+fun f(x) {
+	if (x) { return x; }
+	{ { print "no"; } }
+}
+print f("yes");
+print a;
+)test"s;
+
+	string_source s{"block-elision", test};
+	token_stream tokens{s};
+	parser p{tokens};
+	auto [parse_error, unit] = p.parse();
+	BOOST_REQUIRE(!parse_error);
+
+	std::istringstream in;
+	std::ostringstream out;
+	interpreter inter{&in, &out, &out};
+	resolver res{out, inter};
+	res.resolve(unit->statements());
+	BOOST_REQUIRE(!res.had_error());
+
+	auto const& outer{dynamic_cast<block_stmt const&>(*unit->statements()[1])};
+	auto const& middle{dynamic_cast<block_stmt const&>(*outer.statements()[1])};
+	BOOST_TEST(outer.has_scope());
+	BOOST_TEST(!middle.has_scope());
+	BOOST_TEST(dynamic_cast<block_stmt const&>(*middle.statements()[2]).has_scope());
+
+	for (auto e : {engine::tree_walker, engine::vm, engine::flat})
+	{
+		std::istringstream stdin;
+		std::ostringstream stdout, stderr;
+		Lox intrpr{&stdin, &stdout, &stderr};
+		intrpr.engine(e);
+		intrpr.run(s);
+
+		BOOST_TEST(!intrpr.had_runtime_error());
+		BOOST_REQUIRE_EQUAL(stderr.str(), ""s);
+		BOOST_REQUIRE_EQUAL(stdout.str(), "outer\ninner\nassigned\nyes\nglobal\n"s);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_frame_locals)
+{
+	auto test = R"test(
+fun plain(a, b) {
+	var sum = a + b;
+	{ var twice = sum * 2; sum = twice; }
+	return sum;
+}
+fun outer(p) {
+	var kept = 1;
+	var seen = p;
+	fun inner() { return seen + 1; }
+	kept = kept + inner();
+	return kept;
+}
+print plain(1, 2);
+print outer(10);
+)test"s;
+
+	string_source s{"frame-locals", test};
+	token_stream tokens{s};
+	parser p{tokens};
+	auto [parse_error, unit] = p.parse();
+	BOOST_REQUIRE(!parse_error);
+
+	std::istringstream in;
+	std::ostringstream out;
+	interpreter inter{&in, &out, &out};
+	resolver res{out, inter};
+	res.resolve(unit->statements());
+	BOOST_REQUIRE(!res.had_error());
+
+	// nothing in `plain` is captured: no environment, everything in its frame
+	auto const& plain{dynamic_cast<func_stmt const&>(*unit->statements()[0])};
+	BOOST_TEST(!plain.has_scope());
+	BOOST_TEST(plain.frame_size() == 4u);
+	BOOST_TEST(plain.parameter(0)->in_frame());
+	BOOST_TEST(!dynamic_cast<block_stmt const&>(*plain.body()[1]).has_scope());
+
+	// only `seen` is captured, so it's the one slot in outer's environment
+	auto const& outer{dynamic_cast<func_stmt const&>(*unit->statements()[1])};
+	BOOST_TEST(outer.has_scope());
+	BOOST_TEST(dynamic_cast<var_stmt const&>(*outer.body()[0]).local()->in_frame());
+	auto const& seen{dynamic_cast<var_stmt const&>(*outer.body()[1]).local()};
+	BOOST_TEST(!seen->in_frame());
+	BOOST_TEST(seen->slot == 0u);
+	BOOST_TEST(dynamic_cast<func_stmt const&>(*outer.body()[2]).local()->in_frame());
+
+	inter.interpret(unit->statements());
+	BOOST_REQUIRE_EQUAL(out.str(), "6\n12\n"s);
+}
+
 BOOST_AUTO_TEST_CASE(interpreter_call_not_callable)
 {
 	auto test = R"test(
@@ -387,6 +523,46 @@ for (var i = 0; i < 20; i = i + 1) {
 	BOOST_REQUIRE_EQUAL(output, trim(expected));
 }
 
+BOOST_AUTO_TEST_CASE(interpreter_return_from_nested)
+{
+	auto test = R"test(
+fun find(limit) {
+	var i = 0;
+	while (true) {
+		{
+			if (i * i > limit) {
+				return i;
+			}
+		}
+		i = i + 1;
+	}
+	print "unreachable";
+}
+
+fun nothing() {
+	return;
+}
+
+print find(50);
+print nothing();
+print find(10) + find(3);
+)test"s;
+
+	auto expected = R"expected(
+8
+nil
+6
+)expected"s;
+
+	auto [had_error, had_parse_error, had_runtime_error, output, error] = run_test_case_output("return-from-nested", test);
+
+	BOOST_TEST(!had_error);
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+	BOOST_REQUIRE_EQUAL(output, trim(expected));
+}
+
 BOOST_AUTO_TEST_CASE(interpreter_closure)
 {
 	auto test = R"test(
@@ -420,3 +596,284 @@ counter(); // 2
 }
 
 
+BOOST_AUTO_TEST_CASE(interpreter_local_slots)
+{
+	auto test = R"test(
+var a = "global";
+{
+	var a = "first";
+	var b = "second";
+	fun show() {
+		var c = b = "third";
+		print a;
+		print b;
+		print c;
+	}
+	show();
+	{
+		var b = "shadow";
+		print b;
+	}
+	print b;
+}
+print a;
+)test"s;
+
+	auto expected = R"expected(
+first
+third
+third
+shadow
+third
+global
+)expected"s;
+
+	auto [had_error, had_parse_error, had_runtime_error, output, error] = run_test_case_output("local-slots", test);
+
+	BOOST_TEST(!had_error);
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+	BOOST_REQUIRE_EQUAL(output, trim(expected));
+}
+
+
+BOOST_AUTO_TEST_CASE(interpreter_collects_closure_cycles)
+{
+	// every iteration leaves behind a block environment that holds the
+	// function closing over it
+	auto test = R"test(
+var kept;
+for (var i = 0; i < 5000; i = i + 1) {
+	fun f() { return f; }
+	kept = f;
+}
+print kept() == kept;
+)test"s;
+
+	auto const before{heap::get().tracked()};
+	{
+		std::istringstream stdin;
+		std::ostringstream stdout, stderr;
+		string_source s{"closure-cycles", test};
+		Lox intrpr{&stdin, &stdout, &stderr};
+		intrpr.run(s);
+
+		BOOST_TEST(!intrpr.had_error());
+		BOOST_REQUIRE_EQUAL(trim(stdout.str()), "true"s);
+		BOOST_TEST(heap::get().tracked() - before < 5000u);
+	}
+	BOOST_TEST(heap::get().tracked() == before);
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_function_outlives_run)
+{
+	// the syntax tree of the first run is released when run() returns;
+	// the function it defined must keep its body alive
+	std::istringstream stdin;
+	std::ostringstream stdout, stderr;
+	string_source define{"define", "fun greet(name) { var msg = name; return msg; }"s};
+	string_source use{"use", "print greet(\"hello\");"s};
+
+	Lox intrpr{&stdin, &stdout, &stderr};
+	intrpr.run(define);
+	intrpr.run(use);
+
+	BOOST_TEST(!intrpr.had_error());
+	BOOST_REQUIRE_EQUAL(trim(stderr.str()), ""s);
+	BOOST_REQUIRE_EQUAL(trim(stdout.str()), "hello"s);
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_streamed)
+{
+	std::istringstream stdin;
+	std::ostringstream stdout, stderr;
+	Lox intrpr{&stdin, &stdout, &stderr};
+
+	std::string test;
+	for (int i = 0; i < 100; ++i)
+		test += fmt::format("fun f{0}(n) {{ return n + {0}; }}\nprint f{0}(1);\n", i);
+	string_source s{"streamed", test};
+	intrpr.run_streamed(s);
+
+	std::string expected;
+	for (int i = 0; i < 100; ++i)
+		expected += fmt::format("{}\n", i + 1);
+
+	BOOST_TEST(!intrpr.had_error());
+	BOOST_TEST(!intrpr.had_parse_error());
+	BOOST_TEST(!intrpr.had_runtime_error());
+	BOOST_TEST(stdout.str() == expected);
+	BOOST_TEST(stderr.str() == "");
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_streamed_stops_at_error)
+{
+	std::istringstream stdin;
+	std::ostringstream stdout, stderr;
+	Lox intrpr{&stdin, &stdout, &stderr};
+
+	// declarations before the error have already run
+	string_source parse_error{"streamed-parse", "print 1;\nprint (;\nprint 2;"s};
+	intrpr.run_streamed(parse_error);
+	BOOST_TEST(intrpr.had_parse_error());
+	BOOST_TEST(stdout.str() == "1\n");
+	BOOST_TEST(stderr.str().find("Expect expression.") != std::string::npos);
+
+	stdout.str({});
+	string_source runtime_error{"streamed-runtime", "print 3;\nprint missing;\nprint 4;"s};
+	intrpr.run_streamed(runtime_error);
+	BOOST_TEST(intrpr.had_runtime_error());
+	BOOST_TEST(stdout.str() == "3\n");
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_specializes_binary)
+{
+	auto test = R"test(
+fun eq(a, b) { return a == b; }
+print eq(1, 1);
+print eq("a", "a");
+print eq(1, "1");
+print eq(nil, nil);
+
+fun lt(a, b) { return a < b; }
+print lt(1, 2);
+print lt(2, 1);
+)test"s;
+
+	std::istringstream stdin;
+	std::ostringstream stdout, stderr;
+	interpreter intrpr{&stdin, &stdout, &stderr};
+
+	string_source s{"specializes", test};
+	token_stream tokens{s};
+	parser p{tokens};
+	auto [had_error, unit] = p.parse();
+	BOOST_REQUIRE(!had_error);
+
+	resolver res{stderr, intrpr};
+	res.resolve(unit->statements());
+	BOOST_REQUIRE(!res.had_error());
+
+	auto compared = [&](std::size_t index) -> binary const&
+	{
+		auto fn{dynamic_cast<func_stmt const*>(unit->statements().at(index).get())};
+		BOOST_REQUIRE(fn != nullptr);
+		auto ret{dynamic_cast<return_stmt const*>(fn->body().at(0).get())};
+		BOOST_REQUIRE(ret != nullptr);
+		return static_cast<binary const&>(ret->value()->get());
+	};
+
+	BOOST_TEST((compared(0).profile() == operand_profile::UNSEEN));
+	intrpr.interpret(unit->statements());
+	BOOST_REQUIRE_EQUAL(trim(stdout.str()), "true\ntrue\nfalse\ntrue\ntrue\nfalse"s);
+
+	// numbers first, then a string pair fails the guard
+	BOOST_TEST((compared(0).profile() == operand_profile::GENERIC));
+	BOOST_TEST((compared(5).profile() == operand_profile::NUMBERS));
+
+	// a failed guard still reports the type error the generic path would
+	BOOST_CHECK_THROW(run_test_case("specialized-error", "fun lt(a, b) { return a < b; }\nprint lt(1, 2);\nprint lt(1, nil);"s), type_error);
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_infers_types)
+{
+	auto test = R"test(
+var g = 1;
+{
+	var n = 0;
+	var s = "a";
+	var m;
+	var a = 0;
+	var b = a;
+	a = b;
+	var k = n;
+	k = s;
+	n = n + 1;
+	print n < 10;
+	print s == "b";
+	print m == n;
+	print a < b;
+	print k == s;
+	print g < 2;
+}
+)test"s;
+
+	auto [had_error, had_parse_error, had_runtime_error, output, error] = run_test_case_output("infers-types", test);
+	BOOST_TEST(!had_error);
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+	BOOST_REQUIRE_EQUAL(output, "true\nfalse\nfalse\nfalse\ntrue\ntrue"s);
+
+	std::istringstream stdin;
+	std::ostringstream stdout, stderr;
+	interpreter intrpr{&stdin, &stdout, &stderr};
+
+	string_source s{"infers-types", test};
+	token_stream tokens{s};
+	parser p{tokens};
+	auto [parse_error, unit] = p.parse();
+	BOOST_REQUIRE(!parse_error);
+
+	resolver res{stderr, intrpr};
+	res.resolve(unit->statements());
+	BOOST_REQUIRE(!res.had_error());
+
+	auto block{dynamic_cast<block_stmt const*>(unit->statements().at(1).get())};
+	BOOST_REQUIRE(block != nullptr);
+	auto printed = [&](std::size_t index) -> binary const&
+	{
+		auto stmt{dynamic_cast<print_stmt const*>(block->statements().at(index).get())};
+		BOOST_REQUIRE(stmt != nullptr);
+		return static_cast<binary const&>(stmt->expr());
+	};
+
+	BOOST_TEST((printed(9).profile() == operand_profile::PROVEN_NUMBERS));
+	BOOST_TEST((printed(9).inferred() == inferred_type::BOOL));
+	BOOST_TEST((printed(10).profile() == operand_profile::PROVEN_STRINGS));
+
+	// declared without a value, given both a number and a string, or global
+	BOOST_TEST((printed(11).profile() == operand_profile::UNSEEN));
+	BOOST_TEST((printed(12).profile() == operand_profile::PROVEN_NUMBERS));
+	BOOST_TEST((printed(13).profile() == operand_profile::UNSEEN));
+	BOOST_TEST((printed(13).left().inferred() == inferred_type::UNKNOWN));
+	BOOST_TEST((printed(14).profile() == operand_profile::UNSEEN));
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_prompt_releases_lines)
+{
+	// more lines than there are source ids; only the line defining a
+	// function has to stay alive
+	static constexpr int LINES = 70'000;
+
+	std::string input{"fun inc(n) { return n + 1; }\n"};
+	for (int i = 0; i < LINES; ++i)
+		input += "var x = 1;\n";
+	input += "print inc(x);\n";
+
+	std::istringstream stdin{input};
+	std::ostringstream stdout, stderr;
+	Lox intrpr{&stdin, &stdout, &stderr};
+	intrpr.run_prompt();
+
+	BOOST_REQUIRE_EQUAL(stderr.str(), ""s);
+	BOOST_TEST(stdout.str().find("2\n") != std::string::npos);
+	BOOST_TEST(stdout.str().ends_with("stopped.\n"));
+}
+
+BOOST_AUTO_TEST_CASE(interpreter_unterminated_string)
+{
+	std::istringstream stdin;
+	std::ostringstream stdout, stderr;
+	string_source s{"unterminated", "print \"unterminated;\n"s};
+	Lox intrpr{&stdin, &stdout, &stderr};
+	intrpr.run(s);
+
+	BOOST_TEST(intrpr.had_error());
+	BOOST_REQUIRE_EQUAL(stdout.str(), ""s);
+	BOOST_REQUIRE_EQUAL(stderr.str(),
+		"in unterminated (1:20):Unterminated string.\n"
+		"    1 |print \"unterminated;\n"
+		"      |                    ^\n"
+		"error tokenizing input.\n"s);
+}
@@ -1,10 +1,13 @@
 #include <array>
+#include <cmath>
+#include <limits>
 #include <utility>
 #include <boost/test/unit_test.hpp>
 
 #include "lox/object.hpp"
 
 using namespace lox;
+using namespace std::literals::string_literals;
 
 BOOST_AUTO_TEST_CASE( values )
 {
@@ -106,3 +109,33 @@ BOOST_AUTO_TEST_CASE(bool_conv)
 }
 
 
+BOOST_AUTO_TEST_CASE(boxed_values)
+{
+	object s1{"asdf"};
+	object s2{std::string{"asdf"}};
+	object copy{s1};
+	object nan{0.0 / 0.0};
+
+	BOOST_TEST(s1 == s2);
+	BOOST_TEST(copy.as_string() == s1.as_string());
+	BOOST_TEST(!(nan == nan));
+	BOOST_TEST(!(object{} == object{false}));
+	BOOST_TEST(!(object{0} == object{false}));
+	BOOST_TEST(object{true} == object{true});
+	BOOST_TEST(object{-0.0} == object{0});
+
+	BOOST_TEST(s1.get_type_str() == "str"s);
+	BOOST_TEST(nan.get_type_str() == "double"s);
+	BOOST_TEST(std::signbit(static_cast<double>(object{-std::numeric_limits<double>::quiet_NaN()})));
+	BOOST_TEST(!std::signbit(static_cast<double>(object{std::numeric_limits<double>::quiet_NaN()})));
+	BOOST_TEST(object{}.get_type_str() == "nil"s);
+	BOOST_TEST(object{false}.get_type_str() == "bool"s);
+
+	object moved{std::move(copy)};
+	BOOST_TEST(moved.str() == "asdf");
+	BOOST_TEST(copy.is_nil());
+
+	BOOST_CHECK_THROW(s1 + s2, type_error);
+	BOOST_CHECK_THROW(s1.get<double>(), type_error);
+}
+
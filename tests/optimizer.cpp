@@ -0,0 +1,108 @@
+#include <sstream>
+#include <tuple>
+#include <boost/test/unit_test.hpp>
+
+#include "lox/lox.hpp"
+#include "lox/utility.hpp"
+
+using namespace lox;
+using namespace std::literals::string_literals;
+
+namespace
+{
+	compilation_unit_ptr optimized(std::string text)
+	{
+		string_source s{"optimizer", std::move(text)};
+		token_stream tokens{s};
+		parser p{tokens};
+		auto [had_error, unit] = p.parse();
+		BOOST_REQUIRE(!had_error);
+
+		optimizer{*unit}.optimize();
+		return unit;
+	}
+
+	expression const& printed(compilation_unit const& unit, std::size_t index)
+	{
+		auto stmt{dynamic_cast<print_stmt const*>(unit.statements().at(index).get())};
+		BOOST_REQUIRE(stmt != nullptr);
+		return stmt->expr();
+	}
+
+	std::tuple<bool, std::string, std::string> run_output(std::string source, lox::engine engine)
+	{
+		std::istringstream stdin;
+		std::ostringstream stdout, stderr;
+		string_source s{"optimizer", std::move(source)};
+		Lox intrpr{&stdin, &stdout, &stderr};
+		intrpr.engine(engine);
+		intrpr.run(s);
+
+		return std::make_tuple(intrpr.had_runtime_error(), trim(stdout.str()), trim(stderr.str()));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(optimizer_folds_constants)
+{
+	auto unit{optimized(R"test(
+print (1 + 2) * 3;
+print !true == false;
+print nil or "x";
+var n = 1;
+print (n - 2) * 1;
+print 1 + "a";
+if (1 < 2) print "yes"; else print "no";
+while (!!false) print n;
+)test"s)};
+
+	auto const& sum{printed(*unit, 0)};
+	BOOST_REQUIRE((sum.type() == expression::LITERAL));
+	BOOST_TEST(static_cast<double>(static_cast<literal const&>(sum)) == 9.0);
+
+	auto const& test{printed(*unit, 1)};
+	BOOST_REQUIRE((test.type() == expression::LITERAL));
+	BOOST_TEST(static_cast<bool>(static_cast<literal const&>(test)));
+
+	BOOST_TEST((printed(*unit, 2).type() == expression::LITERAL));
+
+	// `* 1` goes, leaving the subtraction without its grouping
+	auto const& difference{printed(*unit, 4)};
+	BOOST_REQUIRE((difference.type() == expression::BINARY));
+	BOOST_TEST((static_cast<binary const&>(difference).op() == binary_op::SUBTRACT));
+
+	// would raise, so it's left for run time
+	BOOST_TEST((printed(*unit, 5).type() == expression::BINARY));
+
+	// the if is reduced to its taken branch, the while to nothing
+	BOOST_REQUIRE_EQUAL(unit->statements().size(), 7u);
+	BOOST_TEST((printed(*unit, 6).type() == expression::LITERAL));
+}
+
+BOOST_AUTO_TEST_CASE(optimizer_keeps_behavior)
+{
+	auto test = R"test(
+var n = 0;
+var total = 0;
+while (n < 10) {
+	total = total + (2 * 3 - 1) * 1 + -(-n);
+	n = n + 1;
+}
+print total;
+print -(-0);
+print -0 - 0;
+print !!nil;
+print false and 1 / 0;
+)test"s;
+
+	for (auto e : {engine::tree_walker, engine::vm, engine::flat})
+	{
+		auto [had_runtime_error, output, error] = run_output(test, e);
+		BOOST_TEST(!had_runtime_error);
+		BOOST_REQUIRE_EQUAL(error, ""s);
+		BOOST_REQUIRE_EQUAL(output, "95\n0\n-0\nfalse\nfalse"s);
+
+		// type errors still surface when the expression runs
+		BOOST_CHECK_THROW(run_output("print -\"a\";"s, e), type_error);
+		BOOST_CHECK_THROW(run_output("print 2 * (1 < nil);"s, e), type_error);
+	}
+}
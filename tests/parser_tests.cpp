@@ -1,5 +1,5 @@
 #include "lox/parser.hpp"
-#include "lox/scanner.hpp"
+#include "lox/token_stream.hpp"
 #include <string>
 #include <sstream>
 #include <tuple>
@@ -9,32 +9,18 @@
 using namespace std::literals::string_literals;
 using namespace  lox;
 
-inline std::tuple<bool, parser::statement_vec, std::string> run_parser(source& s)
+inline std::tuple<bool, compilation_unit_ptr, std::string> run_parser(source& s)
 {
-	std::vector<token> tokens;
-
-	auto token_handler = [&tokens](token&& tok)
-	{
-		tokens.push_back(std::move(tok));
-	};
-
-	auto error_handler = [](source const& s, std::size_t offset, std::string_view where, std::string_view message)
-	{
-		ignore_unused(s, offset, where, message);
-	};
-
-	using scanner_t = scanner<decltype(token_handler), decltype(error_handler)>;
-
-	scanner_t scan{s, std::move(token_handler), std::move(error_handler)};
-	scan.scan();
+	std::stringstream scan_error;
+	token_stream tokens{s, scan_error};
 
 	std::stringstream error;
 
-	parser p{std::move(tokens), &error};
+	parser p{tokens, &error};
 
-	auto [had_error, statements] = p.parse();
+	auto [had_error, unit] = p.parse();
 
-	return std::make_tuple(had_error, std::move(statements), error.str()); 
+	return std::make_tuple(had_error, std::move(unit), error.str()); 
 }
 
 BOOST_AUTO_TEST_CASE(true_synax_error)
@@ -48,3 +34,28 @@ BOOST_AUTO_TEST_CASE(true_synax_error)
 	BOOST_TEST(had_error);
 }
 
+
+BOOST_AUTO_TEST_CASE(operators_resolved_at_parse)
+{
+	string_source s{"operators_resolved_at_parse", "print -a + b * c <= d or !e;"s};
+
+	auto [had_error, unit, error] = run_parser(s);
+	BOOST_REQUIRE(!had_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+
+	auto stmt{dynamic_cast<print_stmt const*>(unit->statements().at(0).get())};
+	BOOST_REQUIRE(stmt != nullptr);
+
+	auto const& either{static_cast<logical const&>(stmt->expr())};
+	BOOST_TEST((either.op() == logical_op::OR));
+	BOOST_TEST((static_cast<unary const&>(either.right()).op() == unary_op::NOT));
+
+	auto const& compare{static_cast<binary const&>(either.left())};
+	BOOST_TEST((compare.op() == binary_op::LESS_EQUAL));
+	BOOST_TEST(compare.op_token().lexeme() == "<=");
+
+	auto const& sum{static_cast<binary const&>(compare.left())};
+	BOOST_TEST((sum.op() == binary_op::ADD));
+	BOOST_TEST((static_cast<unary const&>(sum.left()).op() == unary_op::NEGATE));
+	BOOST_TEST((static_cast<binary const&>(sum.right()).op() == binary_op::MULTIPLY));
+}
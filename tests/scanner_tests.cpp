@@ -1,4 +1,6 @@
 #include "lox/scanner.hpp"
+#include "lox/token_stream.hpp"
+#include <sstream>
 #include <string>
 #include <tuple>
 
@@ -111,3 +113,121 @@ nil
 	BOOST_TEST(!had_error);
 }
 
+
+BOOST_AUTO_TEST_CASE(literal_values)
+{
+	static_assert(sizeof(token) <= 16);
+
+	string_source s{"literal_values", R"test(12.5 "two
+lines" true false nil ident)test"s};
+	auto [had_error, tokens] = run_scanner(s);
+
+	BOOST_TEST(!had_error);
+	BOOST_REQUIRE_EQUAL(tokens.size(), 7u);
+	BOOST_TEST(tokens[0].literal().get<double>() == 12.5);
+	BOOST_TEST(tokens[1].literal().get<std::string>() == "two\nlines"s);
+	BOOST_TEST(tokens[1].lexeme() == "\"two\nlines\"");
+	BOOST_TEST(tokens[2].literal().get<bool>());
+	BOOST_TEST(!tokens[3].literal().get<bool>());
+	BOOST_TEST(tokens[4].literal().is_nil());
+	BOOST_TEST(tokens[5].lexeme() == "ident");
+	BOOST_TEST(tokens[6].type() == token_type::END_OF_FILE);
+}
+
+BOOST_AUTO_TEST_CASE(keyword_types)
+{
+	string_source s{"keyword_types", "and class else false for fun if nil or print return super this true var while an fals funny t _if"s};
+	auto [had_error, tokens] = run_scanner(s);
+
+	std::vector<token_type> expected{
+		token_type::AND, token_type::CLASS, token_type::ELSE, token_type::FALSE_L,
+		token_type::FOR, token_type::FUN, token_type::IF, token_type::NIL,
+		token_type::OR, token_type::PRINT, token_type::RETURN, token_type::SUPER,
+		token_type::THIS, token_type::TRUE_L, token_type::VAR, token_type::WHILE,
+	};
+	expected.resize(expected.size() + 5, token_type::IDENTIFIER);
+	expected.push_back(token_type::END_OF_FILE);
+
+	BOOST_TEST(!had_error);
+	BOOST_REQUIRE_EQUAL(tokens.size(), expected.size());
+	for (std::size_t i = 0; i < tokens.size(); ++i)
+		BOOST_TEST(tokens[i].type() == expected[i]);
+}
+
+BOOST_AUTO_TEST_CASE(source_line_index)
+{
+	string_source s{"line_index", "first\n\nthird \"two\nlines\" x\nlast"s};
+
+	BOOST_TEST(s.line_count() == 5u);
+	BOOST_TEST(s.line_no(0) == 1u);
+	BOOST_TEST(s.line_no(5) == 1u); // the newline ends its own line
+	BOOST_TEST(s.line_no(6) == 2u);
+	BOOST_TEST(s.line_no(s.size()) == 5u);
+
+	auto [line_no, line_off, line] = s.get_line(9);
+	BOOST_TEST(line_no == 3u);
+	BOOST_TEST(line_off == 2u);
+	BOOST_TEST(line == "third \"two");
+
+	auto [had_error, tokens] = run_scanner(s);
+	BOOST_TEST(!had_error);
+	BOOST_REQUIRE_EQUAL(tokens.size(), 6u);
+	BOOST_TEST(tokens[0].line() == 1u);
+	BOOST_TEST(tokens[1].line() == 3u);
+	BOOST_TEST(tokens[2].line() == 3u); // a string's line is where it starts
+	BOOST_TEST(tokens[3].line() == 4u);
+	BOOST_TEST(tokens[4].line() == 5u);
+	BOOST_TEST(tokens[5].line() == 5u);
+}
+
+BOOST_AUTO_TEST_CASE(identifier_symbols)
+{
+	string_source s{"symbols", "alpha beta alpha var"s};
+
+	auto [had_error, tokens] = run_scanner(s);
+	BOOST_TEST(!had_error);
+	BOOST_REQUIRE_EQUAL(tokens.size(), 5u);
+	BOOST_TEST(tokens[0].symbol() == tokens[2].symbol());
+	BOOST_TEST(tokens[0].symbol() != tokens[1].symbol());
+	BOOST_TEST(tokens[3].symbol() == no_symbol); // keywords aren't interned
+	BOOST_TEST(symbol_name(tokens[1].symbol()) == "beta");
+	BOOST_TEST(intern("alpha") == tokens[0].symbol());
+}
+
+BOOST_AUTO_TEST_CASE(token_stream_matches_scan)
+{
+	std::string test;
+	for (int i = 0; i < 100; ++i)
+		test += "var x = (1 + y) * \"s\"; // comment\n";
+	string_source s{"stream", test};
+
+	auto [had_error, tokens] = run_scanner(s);
+	BOOST_TEST(!had_error);
+
+	std::stringstream error;
+	token_stream stream{s, error};
+	BOOST_TEST(stream.peek(token_stream::MAX_LOOKAHEAD).type() == tokens[token_stream::MAX_LOOKAHEAD].type());
+
+	for (auto&& expected : tokens)
+	{
+		auto const& tok{stream.peek()};
+		BOOST_TEST(tok.type() == expected.type());
+		BOOST_TEST(tok.lexeme() == expected.lexeme());
+		if (tok.type() != token_type::END_OF_FILE)
+			BOOST_TEST(stream.advance().source_location().offset() == expected.source_location().offset());
+	}
+
+	// the end of input is sticky
+	BOOST_TEST(stream.advance().type() == token_type::SEMICOLON);
+	BOOST_TEST(stream.peek(3).type() == token_type::END_OF_FILE);
+	BOOST_TEST(!stream.had_error());
+}
+
+BOOST_AUTO_TEST_CASE(stream_source_reads_to_end)
+{
+	std::istringstream input{"print 1;\nprint 2;\n"};
+	stream_source s{"<pipe>", input};
+
+	BOOST_TEST(s.view() == "print 1;\nprint 2;\n");
+	BOOST_TEST(s.line_count() == 3u);
+}
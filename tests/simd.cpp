@@ -0,0 +1,57 @@
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "lox/simd.hpp"
+
+using namespace lox;
+using namespace std::literals::string_literals;
+
+BOOST_AUTO_TEST_CASE(simd_runs_match_scalar)
+{
+	// runs of every length up to a few registers, so each one ends inside
+	// the vector loop, on a register boundary, or in the scalar tail
+	for (std::size_t len = 0; len < 100; ++len)
+	{
+		std::string ws;
+		for (std::size_t i = 0; i < len; ++i)
+			ws += " \t\r\n"[i % 4];
+
+		auto text{ws + "x" + std::string(len, 'a') + "_9Z" + std::string(len, '\n') + "\"" + ws};
+		auto begin{text.data()};
+		auto end{text.data() + text.size()};
+
+		auto id_start{simd::skip_whitespace(begin, end)};
+		BOOST_REQUIRE_EQUAL(id_start - begin, static_cast<std::ptrdiff_t>(len));
+
+		auto id_end{simd::skip_identifier(id_start, end)};
+		BOOST_REQUIRE_EQUAL(id_end - id_start, static_cast<std::ptrdiff_t>(len + 4));
+
+		auto quote{simd::find_quote(id_end, end)};
+		BOOST_REQUIRE_EQUAL(quote - id_end, static_cast<std::ptrdiff_t>(len));
+
+		auto nl{simd::find_newline(id_start, end)};
+		BOOST_REQUIRE_EQUAL(nl - begin, static_cast<std::ptrdiff_t>(len == 0 ? text.size() : id_end - begin));
+
+		std::vector<std::ptrdiff_t> expected, seen;
+		for (auto p = begin; p != end; ++p)
+		{
+			if (*p == '\n')
+				expected.push_back(p - begin);
+		}
+		simd::for_each_newline(begin, end, [&](const char* p) { seen.push_back(p - begin); });
+		BOOST_TEST(seen == expected);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(simd_stops_at_end)
+{
+	auto text{std::string(40, ' ') + std::string(40, 'q')};
+	auto begin{text.data()};
+	auto end{text.data() + 40};
+
+	BOOST_TEST(simd::skip_whitespace(begin, end) == end);
+	BOOST_TEST(simd::skip_identifier(end, text.data() + text.size()) == text.data() + text.size());
+	BOOST_TEST(simd::find_quote(begin, end) == end);
+	BOOST_TEST(simd::find_newline(begin, end) == end);
+}
@@ -0,0 +1,226 @@
+#include <tuple>
+#include <sstream>
+#include <boost/test/unit_test.hpp>
+
+#include "lox/lox.hpp"
+#include "lox/utility.hpp"
+
+using namespace lox;
+using namespace std::literals::string_literals;
+
+template<typename T, typename U>
+inline std::tuple<bool, bool, std::string, std::string> run_vm_output(T&& name, U&& source)
+{
+	std::istringstream stdin;
+	std::ostringstream stdout, stderr;
+	string_source s{std::forward<T>(name), std::forward<U>(source)};
+	Lox intrpr{&stdin, &stdout, &stderr};
+	intrpr.engine(engine::vm);
+	intrpr.run(s);
+
+	return std::make_tuple(intrpr.had_parse_error(), intrpr.had_runtime_error(), trim(stdout.str()), trim(stderr.str()));
+}
+
+BOOST_AUTO_TEST_CASE(vm_expressions)
+{
+	auto test = R"test(
+print 1 + 2 * 3;
+print (1 + 2) * 3;
+print -4 / 2;
+print !nil;
+print 1 < 2 and 2 <= 2;
+print nil or "default";
+print 3 == 3;
+print "a" != "a";
+)test"s;
+
+	auto expected = R"expected(
+7
+9
+-2
+true
+true
+default
+true
+false
+)expected"s;
+
+	auto [had_parse_error, had_runtime_error, output, error] = run_vm_output("vm-expressions", test);
+
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+	BOOST_REQUIRE_EQUAL(output, trim(expected));
+}
+
+BOOST_AUTO_TEST_CASE(vm_scope)
+{
+	auto test = R"test(
+var a = "global a";
+var b = "global b";
+{
+	var a = "outer a";
+	{
+		var a = "inner a";
+		print a;
+		print b;
+	}
+	print a;
+	b = "assigned b";
+}
+print a;
+print b;
+)test"s;
+
+	auto expected = R"expected(
+inner a
+global b
+outer a
+global a
+assigned b
+)expected"s;
+
+	auto [had_parse_error, had_runtime_error, output, error] = run_vm_output("vm-scope", test);
+
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+	BOOST_REQUIRE_EQUAL(output, trim(expected));
+}
+
+BOOST_AUTO_TEST_CASE(vm_loops_and_calls)
+{
+	auto test = R"test(
+fun fib(n) {
+	if (n <= 1) return n;
+	return fib(n - 2) + fib(n - 1);
+}
+
+for (var i = 0; i < 10; i = i + 1) {
+	print fib(i);
+}
+print fib;
+)test"s;
+
+	auto expected = R"expected(
+0
+1
+1
+2
+3
+5
+8
+13
+21
+34
+<fn fib>
+)expected"s;
+
+	auto [had_parse_error, had_runtime_error, output, error] = run_vm_output("vm-loops-and-calls", test);
+
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+	BOOST_REQUIRE_EQUAL(output, trim(expected));
+}
+
+BOOST_AUTO_TEST_CASE(vm_closures)
+{
+	auto test = R"test(
+fun makeCounter() {
+	var i = 0;
+	fun count() {
+		i = i + 1;
+		return i;
+	}
+	fun peek() {
+		return i;
+	}
+	print count() + peek();
+	return count;
+}
+
+var counter = makeCounter();
+print counter();
+print counter();
+)test"s;
+
+	auto expected = R"expected(
+2
+2
+3
+)expected"s;
+
+	auto [had_parse_error, had_runtime_error, output, error] = run_vm_output("vm-closures", test);
+
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+	BOOST_REQUIRE_EQUAL(output, trim(expected));
+}
+
+BOOST_AUTO_TEST_CASE(vm_runtime_errors)
+{
+	auto [had_parse_error, had_runtime_error, output, error] = run_vm_output("vm-undefined", "print missing;"s);
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, "Undefined variable 'missing'."s);
+
+	auto [had_parse_error2, had_runtime_error2, output2, error2] = run_vm_output("vm-arity", "fun f(a) {} f();"s);
+	BOOST_TEST(had_runtime_error2);
+	BOOST_REQUIRE_EQUAL(error2, "Exepcted 1 arguments but got 0."s);
+
+	BOOST_CHECK_THROW(run_vm_output("vm-not-callable", "var a = 0; a();"s), type_error);
+}
+
+BOOST_AUTO_TEST_CASE(vm_error_closes_upvalues)
+{
+	// a closure that escaped before a runtime error keeps its value
+	std::istringstream stdin{
+		"var g; { var x = 42; fun f() { return x; } g = f; var y = undefinedthing; }\n"
+		"{ var p = \"p\"; print g(); }\n"s
+	};
+	std::ostringstream stdout, stderr;
+	Lox intrpr{&stdin, &stdout, &stderr};
+	intrpr.engine(engine::vm);
+	intrpr.run_prompt();
+
+	BOOST_REQUIRE_EQUAL(trim(stderr.str()), "Undefined variable 'undefinedthing'."s);
+	BOOST_REQUIRE_EQUAL(stdout.str(), "lox REPL. Enter EOF to stop.\n> > 42\n> stopped.\n"s);
+}
+
+BOOST_AUTO_TEST_CASE(vm_deep_recursion)
+{
+	auto test = R"test(
+fun r(n) { if (n == 0) return 0; return 1 + r(n - 1); }
+print r(1000);
+)test"s;
+
+	auto [had_parse_error, had_runtime_error, output, error] = run_vm_output("vm-deep-recursion", test);
+	BOOST_TEST(!had_parse_error);
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(error, ""s);
+	BOOST_REQUIRE_EQUAL(output, "1000"s);
+
+	// unbounded recursion is still reported, not a crash
+	auto [had_parse_error2, had_runtime_error2, output2, error2] = run_vm_output("vm-overflow", "fun f() { return f(); } f();"s);
+	BOOST_TEST(had_runtime_error2);
+	BOOST_REQUIRE_EQUAL(error2, "Stack overflow."s);
+}
+
+BOOST_AUTO_TEST_CASE(vm_collects_closure_cycles)
+{
+	auto const before{heap::get().tracked()};
+
+	auto [had_parse_error, had_runtime_error, output, error] = run_vm_output("vm-closure-cycles", R"test(
+for (var i = 0; i < 3000; i = i + 1) {
+	fun f() { return f; }
+	f();
+}
+print "done";
+)test"s);
+
+	BOOST_TEST(!had_runtime_error);
+	BOOST_REQUIRE_EQUAL(output, "done"s);
+	BOOST_TEST(heap::get().tracked() == before);
+}